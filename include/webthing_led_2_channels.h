@@ -9,8 +9,12 @@
 #ifndef LED_2_CHANNELS_H_
 #define LED_2_CHANNELS_H_
 
+#include <stdint.h>
+
 //---------------------------------------------------------
 thing_t *init_led_2_channels(void);
 void daily_on_time_reset(void);
+void get_led_power_stats(uint64_t *active_ms, uint64_t *idle_ms);
+void get_led_load_stats(uint32_t *peak_mw, uint32_t *limited);
 
 #endif /* LED_2_CHANNELS_H_ */
@@ -0,0 +1,219 @@
+/* *********************************************************
+ * Command path benchmark
+ *
+ * Concurrent clients call the property setters and actions
+ * the way server and binary endpoint tasks do on the device.
+ * Reported overall and per command: commands per second,
+ * exact p50/p99 latency (including the LED mutex wait),
+ * rejection rate and the cost of informing subscribers.
+ * The on-device LED_CMD_STATS estimate is printed at the end
+ * for comparison.
+ *
+ * usage: bench_cmd [-c clients] [-d seconds] [-n notify_us]
+ *					[-t think_us] [-p max_p99_us] [-r min_cmd_per_s]
+ ************************************************************/
+#include <getopt.h>
+#include <unistd.h>
+
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+#define BENCH_SAMPLES	(1 << 18)	//per client
+
+typedef enum {
+	OP_ON = 0,
+	OP_BRGH,
+	OP_CHANNEL,
+	OP_FADE,
+	OP_CCT,
+	OP_APPLY,
+	OP_TIMER,
+	OP_NUMBER
+} op_t;
+
+static const char *op_name[OP_NUMBER] = {"on", "brightness", "channel",
+		"fade-time", "color-temp", "apply", "timer"};
+static const int op_weight[OP_NUMBER] = {15, 30, 15, 15, 10, 10, 5};
+
+typedef struct {
+	uint32_t us;
+	uint8_t op;
+	uint8_t rejected;
+} sample_t;
+
+typedef struct {
+	pthread_t thread;
+	unsigned seed;
+	sample_t *samples;
+	uint32_t n;
+} client_t;
+
+static int clients_number = 16;
+static int duration_s = 3;
+static int think_us = 100000;
+static volatile bool bench_stop = false;
+
+
+static op_t pick_op(unsigned *seed){
+	int r = rand_r(seed) % 100;
+
+	for (int i = 0; i < OP_NUMBER; i++){
+		if (r < op_weight[i]){
+			return i;
+		}
+		r -= op_weight[i];
+	}
+	return OP_BRGH;
+}
+
+static int16_t run_op(op_t op, unsigned *seed){
+	char buff[96];
+
+	switch (op){
+	case OP_ON:
+		return sim_put(on_prop_id, (rand_r(seed) & 1) ? "true" : "false");
+	case OP_BRGH:
+		snprintf(buff, sizeof(buff), "%d", rand_r(seed) % 101);
+		return sim_put(brgh_id, buff);
+	case OP_CHANNEL:
+		return sim_put(channel_prop_id, channel_tab[rand_r(seed) % CH_NUMBER]);
+	case OP_FADE:
+		snprintf(buff, sizeof(buff), "%d", 100 + rand_r(seed) % 300);
+		return sim_put(fade_time_id, buff);
+	case OP_CCT:
+		snprintf(buff, sizeof(buff), "%d", CCT_WARM + rand_r(seed) % (CCT_COOL - CCT_WARM));
+		return sim_put(color_temp_id, buff);
+	case OP_APPLY:
+		snprintf(buff, sizeof(buff), "{\"on\":true,\"brightness\":%d,\"fade-time\":%d}",
+				rand_r(seed) % 101, 100 + rand_r(seed) % 300);
+		return sim_run(apply_id, buff);
+	case OP_TIMER:
+	default:
+		return sim_run(timer_id, "{\"duration\":1}");
+	}
+}
+
+static void *client_fun(void *arg){
+	client_t *c = arg;
+
+	while ((bench_stop == false) && (c -> n < BENCH_SAMPLES)){
+		op_t op = pick_op(&c -> seed);
+		int64_t start = sim_real_us();
+		int16_t res = run_op(op, &c -> seed);
+		sample_t *s = &c -> samples[c -> n++];
+
+		s -> us = (uint32_t)(sim_real_us() - start);
+		s -> op = op;
+		s -> rejected = (res < 0);
+		if (think_us > 0){
+			usleep(think_us);
+		}
+	}
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b){
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+//exact percentile of sorted latencies, nearest rank
+static uint32_t percentile(const uint32_t *v, uint32_t n, uint32_t pct){
+	uint32_t rank = (n * pct + 99) / 100;
+
+	return (n == 0) ? 0 : v[(rank > 0) ? rank - 1 : 0];
+}
+
+//statistics of one command type, op < 0 - all commands
+static uint32_t report(client_t *c, int op, uint32_t *lat, double seconds){
+	uint32_t n = 0, rejected = 0;
+
+	for (int i = 0; i < clients_number; i++){
+		for (uint32_t j = 0; j < c[i].n; j++){
+			if ((op < 0) || (c[i].samples[j].op == op)){
+				lat[n++] = c[i].samples[j].us;
+				rejected += c[i].samples[j].rejected;
+			}
+		}
+	}
+	qsort(lat, n, sizeof(uint32_t), cmp_u32);
+	printf("%-12s %9u %10.1f %8u %8u %8u %8.1f%%\n",
+			(op < 0) ? "all" : op_name[op], n, n / seconds,
+			percentile(lat, n, 50), percentile(lat, n, 99),
+			(n > 0) ? lat[n - 1] : 0,
+			(n > 0) ? 100.0 * rejected / n : 0.0);
+	return percentile(lat, n, 99);
+}
+
+int main(int argc, char *argv[]){
+	int notify_us = 200, max_p99 = 0, min_rate = 0, opt;
+	client_t *c;
+	uint32_t *lat, total = 0, p99, notifications;
+	int64_t start, notify_time;
+	double seconds;
+
+	while ((opt = getopt(argc, argv, "c:d:n:t:p:r:")) != -1){
+		switch (opt){
+		case 'c': clients_number = atoi(optarg); break;
+		case 'd': duration_s = atoi(optarg); break;
+		case 'n': notify_us = atoi(optarg); break;
+		case 't': think_us = atoi(optarg); break;
+		case 'p': max_p99 = atoi(optarg); break;
+		case 'r': min_rate = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-c clients] [-d seconds] [-n notify_us] "
+					"[-t think_us] [-p max_p99_us] [-r min_cmd_per_s]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	sim_init(false);
+	sim_notify_delay(notify_us);
+	init_led_2_channels();
+	sim_sleep_ms(100);
+
+	c = calloc(clients_number, sizeof(client_t));
+	for (int i = 0; i < clients_number; i++){
+		c[i].seed = 1000 + i;
+		c[i].samples = malloc(BENCH_SAMPLES * sizeof(sample_t));
+	}
+	notifications = sim_server.notifications;
+	notify_time = sim_server.notify_us;
+	start = sim_real_us();
+	for (int i = 0; i < clients_number; i++){
+		pthread_create(&c[i].thread, NULL, client_fun, &c[i]);
+	}
+	sim_sleep_ms(duration_s * 1000);
+	bench_stop = true;
+	for (int i = 0; i < clients_number; i++){
+		pthread_join(c[i].thread, NULL);
+		total += c[i].n;
+	}
+	seconds = (sim_real_us() - start) / 1e6;
+	notifications = sim_server.notifications - notifications;
+	notify_time = sim_server.notify_us - notify_time;
+
+	printf("\n%d clients, %.2f s, think time %d us, subscriber message %d us\n",
+			clients_number, seconds, think_us, notify_us);
+	printf("%-12s %9s %10s %8s %8s %8s %9s\n", "command", "count", "cmd/s",
+			"p50 us", "p99 us", "max us", "rejected");
+	lat = malloc((total + 1) * sizeof(uint32_t));
+	p99 = report(c, -1, lat, seconds);
+	for (int op = 0; op < OP_NUMBER; op++){
+		report(c, op, lat, seconds);
+	}
+	printf("notifications sent by the component: %u (%.2f per command, avg %" PRId64
+			" us)\n", notifications, total ? (double)notifications / total : 0.0,
+			notifications ? notify_time / notifications : (int64_t)0);
+	printf("on-device estimate: ");
+	cmd_stats_report();
+
+	if ((max_p99 > 0) && (p99 > (uint32_t)max_p99)){
+		CHECK(false, "p99 %u us above limit %d us", p99, max_p99);
+	}
+	if ((min_rate > 0) && (total / seconds < min_rate)){
+		CHECK(false, "%.1f cmd/s below limit %d", total / seconds, min_rate);
+	}
+	return sim_done("bench_cmd");
+}
@@ -0,0 +1,1406 @@
+/* *********************************************************
+ * Host simulator of the ESP-IDF services used by the
+ * LED 2 channel controller, see sim.h
+ *
+ * All simulated objects are protected by one mutex. A task
+ * that has to wait registers its deadline and blocks on one
+ * condition variable, every state change wakes all waiters
+ * and they check their own condition again. In frozen mode
+ * sim_advance() moves the clock to the nearest deadline only
+ * when all tasks are blocked, so events are handled in order
+ * of their virtual time, independently of host scheduling.
+ ************************************************************/
+#define _GNU_SOURCE
+#define SIM_NO_TIME_MACRO
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_pm.h"
+#include "driver/ledc.h"
+#include "driver/gpio.h"
+#include "nvs_flash.h"
+#include "lwip/sockets.h"
+#undef bind
+
+#define SIM_NEVER			INT64_MAX
+#define SIM_START_US		1000000		//esp_timer clock at start
+#define SIM_TICK_US			(1000000 / configTICK_RATE_HZ)
+#define SIM_TASKS			16
+#define SIM_WAITERS			64
+#define SIM_SEMS			8
+#define SIM_TIMERS			16
+#define SIM_ESP_TIMERS		8
+#define SIM_PM_LOCKS		4
+#define SIM_NVS_KEYS		16
+#define SIM_GPIOS			40
+#define SIM_PROPS			16
+#define SIM_ACTIONS			4
+#define SIM_THREAD_STACK	(256 * 1024)
+#define SIM_HEAP_SIZE		(300 * 1024)
+
+struct sim_task {
+	bool used;
+	bool deleted;
+	char name[16];
+	TaskFunction_t fun;
+	void *param;
+	uint32_t stack;
+	uint32_t value;			//task notification
+	bool pending;
+	pthread_t thread;
+};
+
+struct sim_sem {
+	bool used;
+	bool taken;
+};
+
+struct sim_timer {
+	bool used;
+	bool reload;
+	bool active;
+	TickType_t period;
+	TimerCallbackFunction_t cb;
+	int64_t expiry;
+};
+
+struct esp_timer {
+	bool used;
+	bool active;
+	esp_timer_cb_t cb;
+	void *arg;
+	int64_t period;
+	int64_t expiry;
+};
+
+struct esp_pm_lock {
+	bool used;
+	int count;
+};
+
+typedef struct {
+	bool used;
+	bool woken;
+	int64_t deadline;
+} sim_waiter_t;
+
+typedef struct {
+	uint32_t from;
+	uint32_t to;
+	int64_t start;
+	int64_t len;
+	uint32_t fade_to;
+	int32_t fade_ms;
+	uint32_t set_duty;
+	bool stopped;
+} sim_ch_t;
+
+typedef struct {
+	bool used;
+	char key[16];
+	int32_t value;
+} sim_nvs_t;
+
+static pthread_mutex_t sim_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond;
+static bool sim_frozen = false;
+static int64_t sim_real_start = 0;
+static int64_t sim_offset = SIM_START_US;	//real time mode
+static int64_t sim_vnow = SIM_START_US;		//frozen mode
+static int64_t sim_wall_base = 0;			//wall clock - virtual clock [us]
+static int sim_running = 0;					//tasks not blocked in the simulator
+static uint64_t sim_gen = 0;
+static sim_waiter_t sim_waiters[SIM_WAITERS];
+static __thread struct sim_task *sim_self = NULL;
+
+static struct sim_task sim_tasks[SIM_TASKS];
+static struct sim_sem sim_sems[SIM_SEMS];
+static struct sim_timer sim_timers[SIM_TIMERS];
+static struct esp_timer sim_esp_timers[SIM_ESP_TIMERS];
+static struct esp_pm_lock sim_pm_locks[SIM_PM_LOCKS];
+static TaskHandle_t sim_timer_task = NULL;
+
+static sim_ch_t sim_ch[LEDC_CHANNEL_MAX];
+static bool sim_ledc_paused = false;
+sim_ledc_t sim_ledc;
+void (*sim_ledc_hook)(int ch, uint32_t from, uint32_t to, int32_t ms) = NULL;
+
+static sim_nvs_t sim_nvs[SIM_NVS_KEYS];
+uint32_t sim_nvs_commits = 0;
+
+static int sim_gpio_level[SIM_GPIOS];
+static gpio_isr_t sim_gpio_isr[SIM_GPIOS];
+static void *sim_gpio_arg[SIM_GPIOS];
+static bool sim_isr_service = false;
+
+char things_context[] = "https://webthings.io/schemas";
+sim_server_t sim_server;
+static pthread_mutex_t sim_server_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int32_t sim_notify_us = 0;
+static property_t *sim_props[SIM_PROPS];
+static uint32_t sim_props_notified[SIM_PROPS];
+static int sim_props_number = 0;
+static action_t *sim_actions[SIM_ACTIONS];
+static uint32_t sim_actions_completed[SIM_ACTIONS];
+static int sim_actions_number = 0;
+
+static struct {
+	int16_t (*fun)(void *arg);
+	void *arg;
+	int16_t res;
+	bool done;
+} sim_httpd_req;
+static TaskHandle_t sim_httpd = NULL;
+
+static int sim_port_off = 0;
+int sim_failures = 0;
+
+
+/****************************************************************
+ *
+ * clock and scheduling
+ *
+ ****************************************************************/
+int64_t sim_real_us(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t sim_now(void){
+	if (sim_frozen == true){
+		return __atomic_load_n(&sim_vnow, __ATOMIC_ACQUIRE);
+	}
+	return sim_real_us() - sim_real_start + __atomic_load_n(&sim_offset, __ATOMIC_ACQUIRE);
+}
+
+//all waiters check their condition again, sim_mtx is held
+static void sim_wake(void){
+	sim_gen++;
+	for (int i = 0; i < SIM_WAITERS; i++){
+		if ((sim_waiters[i].used == true) && (sim_waiters[i].woken == false)){
+			sim_waiters[i].woken = true;
+			sim_running++;
+		}
+	}
+	pthread_cond_broadcast(&sim_cond);
+}
+
+//wait for sim_wake() or deadline, sim_mtx is held
+static void sim_block(int64_t deadline){
+	sim_waiter_t *w = NULL;
+	uint64_t gen = sim_gen;
+
+	if (sim_self != NULL){
+		for (int i = 0; i < SIM_WAITERS; i++){
+			if (sim_waiters[i].used == false){
+				w = &sim_waiters[i];
+				break;
+			}
+		}
+		if (w == NULL){
+			fprintf(stderr, "sim: too many waiting tasks\n");
+			abort();
+		}
+		w -> used = true;
+		w -> woken = false;
+		w -> deadline = deadline;
+		sim_running--;
+		pthread_cond_broadcast(&sim_cond);
+	}
+	for (;;){
+		if ((w != NULL) ? w -> woken : (sim_gen != gen)){
+			break;
+		}
+		if ((deadline != SIM_NEVER) && (sim_now() >= deadline)){
+			break;
+		}
+		if ((sim_frozen == true) || (deadline == SIM_NEVER)){
+			pthread_cond_wait(&sim_cond, &sim_mtx);
+		}
+		else{
+			int64_t t = sim_real_us() + (deadline - sim_now());
+			struct timespec ts = {.tv_sec = t / 1000000, .tv_nsec = (t % 1000000) * 1000};
+
+			pthread_cond_timedwait(&sim_cond, &sim_mtx, &ts);
+		}
+	}
+	if (w != NULL){
+		if (w -> woken == false){
+			sim_running++;
+		}
+		w -> used = false;
+	}
+}
+
+static int64_t sim_deadline(TickType_t ticks){
+	if (ticks == portMAX_DELAY){
+		return SIM_NEVER;
+	}
+	return sim_now() + (int64_t)ticks * SIM_TICK_US;
+}
+
+//frozen mode, all tasks are blocked: move clock to the nearest deadline
+//not later than end and wake tasks, sim_mtx is held
+static bool sim_step(int64_t end){
+	int64_t next = SIM_NEVER;
+
+	for (int i = 0; i < SIM_WAITERS; i++){
+		if ((sim_waiters[i].used == true) && (sim_waiters[i].woken == false) &&
+			(sim_waiters[i].deadline < next)){
+			next = sim_waiters[i].deadline;
+		}
+	}
+	if ((next == SIM_NEVER) || (next > end)){
+		return false;
+	}
+	if (next > sim_vnow){
+		__atomic_store_n(&sim_vnow, next, __ATOMIC_RELEASE);
+	}
+	sim_wake();
+	return true;
+}
+
+void sim_advance(int64_t us){
+	int64_t end;
+
+	pthread_mutex_lock(&sim_mtx);
+	if (sim_frozen == false){
+		__atomic_add_fetch(&sim_offset, us, __ATOMIC_RELEASE);
+		sim_wake();
+		pthread_mutex_unlock(&sim_mtx);
+		return;
+	}
+	end = sim_vnow + us;
+	do {
+		while (sim_running > 0){
+			pthread_cond_wait(&sim_cond, &sim_mtx);
+		}
+	} while (sim_step(end) == true);
+	__atomic_store_n(&sim_vnow, end, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&sim_mtx);
+}
+
+void sim_settle(void){
+	if (sim_frozen == false){
+		return;
+	}
+	pthread_mutex_lock(&sim_mtx);
+	while (sim_running > 0){
+		pthread_cond_wait(&sim_cond, &sim_mtx);
+	}
+	pthread_mutex_unlock(&sim_mtx);
+}
+
+void sim_sleep_ms(int ms){
+	usleep(ms * 1000);
+}
+
+void sim_set_wall(time_t t){
+	__atomic_store_n(&sim_wall_base, (int64_t)t * 1000000 - sim_now(), __ATOMIC_RELEASE);
+}
+
+time_t sim_time(time_t *t){
+	time_t now = (time_t)((__atomic_load_n(&sim_wall_base, __ATOMIC_ACQUIRE) + sim_now()) / 1000000);
+
+	if (t != NULL){
+		*t = now;
+	}
+	return now;
+}
+
+int64_t esp_timer_get_time(void){
+	return sim_now();
+}
+
+
+/****************************************************************
+ *
+ * tasks and notifications
+ *
+ ****************************************************************/
+static void *sim_task_entry(void *arg){
+	struct sim_task *t = arg;
+
+	sim_self = t;
+	t -> fun(t -> param);
+	fprintf(stderr, "sim: task %s returned\n", t -> name);
+	abort();
+	return NULL;
+}
+
+static struct sim_task *sim_task_new(TaskFunction_t fun, const char *name,
+									uint32_t stack, void *param){
+	struct sim_task *t = NULL;
+	pthread_attr_t attr;
+
+	pthread_mutex_lock(&sim_mtx);
+	for (int i = 0; i < SIM_TASKS; i++){
+		if (sim_tasks[i].used == false){
+			t = &sim_tasks[i];
+			break;
+		}
+	}
+	if (t == NULL){
+		fprintf(stderr, "sim: too many tasks\n");
+		abort();
+	}
+	memset(t, 0, sizeof(struct sim_task));
+	t -> used = true;
+	snprintf(t -> name, sizeof(t -> name), "%s", name);
+	t -> fun = fun;
+	t -> param = param;
+	t -> stack = stack;
+	sim_running++;
+	pthread_mutex_unlock(&sim_mtx);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, SIM_THREAD_STACK);
+	pthread_create(&t -> thread, &attr, sim_task_entry, t);
+	pthread_attr_destroy(&attr);
+	return t;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fun, const char *name, uint32_t stack,
+		void *param, UBaseType_t prio, TaskHandle_t *handle){
+	TaskHandle_t t = sim_task_new(fun, name, stack, param);
+
+	if (handle != NULL){
+		*handle = t;
+	}
+	return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fun, const char *name, uint32_t stack,
+		void *param, UBaseType_t prio, StackType_t *stack_buf, StaticTask_t *task_buf){
+	return sim_task_new(fun, name, stack, param);
+}
+
+void vTaskDelete(TaskHandle_t task){
+	if ((task != NULL) && (task != sim_self)){
+		fprintf(stderr, "sim: deleting other tasks is not supported\n");
+		abort();
+	}
+	pthread_mutex_lock(&sim_mtx);
+	sim_self -> deleted = true;
+	sim_running--;
+	pthread_cond_broadcast(&sim_cond);
+	pthread_mutex_unlock(&sim_mtx);
+	pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks){
+	pthread_mutex_lock(&sim_mtx);
+	int64_t deadline = sim_deadline(ticks);
+
+	while (sim_now() < deadline){
+		sim_block(deadline);
+	}
+	pthread_mutex_unlock(&sim_mtx);
+}
+
+TickType_t xTaskGetTickCount(void){
+	return (TickType_t)(sim_now() / SIM_TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void){
+	return sim_self;
+}
+
+static void sim_task_check(TaskHandle_t task, const char *fun){
+	if ((task == NULL) || (task -> deleted == true)){
+		fprintf(stderr, "sim: %s() on %s task\n", fun,
+				(task == NULL) ? "NULL" : "deleted");
+		abort();
+	}
+}
+
+//host stacks are not measured, half of the declared depth is reported
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task){
+	sim_task_check((task == NULL) ? sim_self : task, __func__);
+	return ((task == NULL) ? sim_self : task) -> stack / 2;
+}
+
+static BaseType_t sim_notify(TaskHandle_t task, uint32_t value, eNotifyAction action){
+	BaseType_t res = pdPASS;
+
+	pthread_mutex_lock(&sim_mtx);
+	sim_task_check(task, "xTaskNotify");
+	switch (action){
+	case eSetBits:
+		task -> value |= value;
+		break;
+	case eIncrement:
+		task -> value++;
+		break;
+	case eSetValueWithOverwrite:
+		task -> value = value;
+		break;
+	case eSetValueWithoutOverwrite:
+		if (task -> pending == true){
+			res = pdFAIL;
+		}
+		else{
+			task -> value = value;
+		}
+		break;
+	default:
+		break;
+	}
+	task -> pending = true;
+	sim_wake();
+	pthread_mutex_unlock(&sim_mtx);
+	return res;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action){
+	return sim_notify(task, value, action);
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+		BaseType_t *woken){
+	if (woken != NULL){
+		*woken = pdFALSE;
+	}
+	return sim_notify(task, value, action);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+		uint32_t *value, TickType_t ticks){
+	struct sim_task *t = sim_self;
+	BaseType_t res = pdFALSE;
+
+	pthread_mutex_lock(&sim_mtx);
+	int64_t deadline = sim_deadline(ticks);
+
+	if (t -> pending == false){
+		t -> value &= ~clear_on_entry;
+	}
+	while ((t -> pending == false) &&
+			((deadline == SIM_NEVER) || (sim_now() < deadline))){
+		sim_block(deadline);
+	}
+	if (value != NULL){
+		*value = t -> value;
+	}
+	if (t -> pending == true){
+		t -> value &= ~clear_on_exit;
+		t -> pending = false;
+		res = pdTRUE;
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return res;
+}
+
+
+/****************************************************************
+ *
+ * mutexes
+ *
+ ****************************************************************/
+SemaphoreHandle_t xSemaphoreCreateMutex(void){
+	struct sim_sem *s = NULL;
+
+	pthread_mutex_lock(&sim_mtx);
+	for (int i = 0; i < SIM_SEMS; i++){
+		if (sim_sems[i].used == false){
+			s = &sim_sems[i];
+			s -> used = true;
+			s -> taken = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf){
+	return xSemaphoreCreateMutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks){
+	BaseType_t res = pdTRUE;
+
+	pthread_mutex_lock(&sim_mtx);
+	int64_t deadline = sim_deadline(ticks);
+
+	while (sem -> taken == true){
+		if ((deadline != SIM_NEVER) && (sim_now() >= deadline)){
+			res = pdFALSE;
+			break;
+		}
+		sim_block(deadline);
+	}
+	if (res == pdTRUE){
+		sem -> taken = true;
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return res;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem){
+	pthread_mutex_lock(&sim_mtx);
+	sem -> taken = false;
+	sim_wake();
+	pthread_mutex_unlock(&sim_mtx);
+	return pdTRUE;
+}
+
+
+/****************************************************************
+ *
+ * software timers, FreeRTOS daemon task and esp_timer task
+ *
+ ****************************************************************/
+static void sim_timer_fun(void *arg){
+	pthread_mutex_lock(&sim_mtx);
+	for (;;){
+		struct sim_timer *next = NULL;
+
+		for (int i = 0; i < SIM_TIMERS; i++){
+			struct sim_timer *t = &sim_timers[i];
+
+			if ((t -> used == true) && (t -> active == true) &&
+				((next == NULL) || (t -> expiry < next -> expiry))){
+				next = t;
+			}
+		}
+		if ((next != NULL) && (next -> expiry <= sim_now())){
+			if (next -> reload == true){
+				next -> expiry += (int64_t)next -> period * SIM_TICK_US;
+			}
+			else{
+				next -> active = false;
+			}
+			pthread_mutex_unlock(&sim_mtx);
+			next -> cb(next);
+			pthread_mutex_lock(&sim_mtx);
+			continue;
+		}
+		sim_block((next != NULL) ? next -> expiry : SIM_NEVER);
+	}
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload,
+		void *id, TimerCallbackFunction_t cb){
+	struct sim_timer *t = NULL;
+
+	pthread_mutex_lock(&sim_mtx);
+	for (int i = 0; i < SIM_TIMERS; i++){
+		if (sim_timers[i].used == false){
+			t = &sim_timers[i];
+			memset(t, 0, sizeof(struct sim_timer));
+			t -> used = true;
+			t -> period = period;
+			t -> reload = (reload == pdTRUE);
+			t -> cb = cb;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return t;
+}
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t reload,
+		void *id, TimerCallbackFunction_t cb, StaticTimer_t *buf){
+	return xTimerCreate(name, period, reload, id, cb);
+}
+
+static BaseType_t sim_timer_set(TimerHandle_t timer, bool active, TickType_t period){
+	pthread_mutex_lock(&sim_mtx);
+	if (period > 0){
+		timer -> period = period;
+	}
+	timer -> active = active;
+	timer -> expiry = sim_now() + (int64_t)timer -> period * SIM_TICK_US;
+	sim_wake();
+	pthread_mutex_unlock(&sim_mtx);
+	return pdPASS;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait){
+	return sim_timer_set(timer, true, 0);
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait){
+	return sim_timer_set(timer, true, 0);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait){
+	return sim_timer_set(timer, false, 0);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait){
+	return sim_timer_set(timer, true, period);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer){
+	return (timer -> active == true) ? pdTRUE : pdFALSE;
+}
+
+TaskHandle_t xTimerGetTimerDaemonTaskHandle(void){
+	return sim_timer_task;
+}
+
+static void sim_esp_timer_fun(void *arg){
+	pthread_mutex_lock(&sim_mtx);
+	for (;;){
+		struct esp_timer *next = NULL;
+
+		for (int i = 0; i < SIM_ESP_TIMERS; i++){
+			struct esp_timer *t = &sim_esp_timers[i];
+
+			if ((t -> used == true) && (t -> active == true) &&
+				((next == NULL) || (t -> expiry < next -> expiry))){
+				next = t;
+			}
+		}
+		if ((next != NULL) && (next -> expiry <= sim_now())){
+			if (next -> period > 0){
+				next -> expiry += next -> period;
+			}
+			else{
+				next -> active = false;
+			}
+			pthread_mutex_unlock(&sim_mtx);
+			next -> cb(next -> arg);
+			pthread_mutex_lock(&sim_mtx);
+			continue;
+		}
+		sim_block((next != NULL) ? next -> expiry : SIM_NEVER);
+	}
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer){
+	esp_err_t err = ESP_ERR_NO_MEM;
+
+	pthread_mutex_lock(&sim_mtx);
+	for (int i = 0; i < SIM_ESP_TIMERS; i++){
+		if (sim_esp_timers[i].used == false){
+			struct esp_timer *t = &sim_esp_timers[i];
+
+			memset(t, 0, sizeof(struct esp_timer));
+			t -> used = true;
+			t -> cb = args -> callback;
+			t -> arg = args -> arg;
+			*timer = t;
+			err = ESP_OK;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return err;
+}
+
+static esp_err_t sim_esp_timer_start(esp_timer_handle_t timer, uint64_t us, bool periodic){
+	esp_err_t err = ESP_OK;
+
+	pthread_mutex_lock(&sim_mtx);
+	if (timer -> active == true){
+		err = ESP_ERR_INVALID_STATE;
+	}
+	else{
+		timer -> active = true;
+		timer -> period = (periodic == true) ? (int64_t)us : 0;
+		timer -> expiry = sim_now() + (int64_t)us;
+		sim_wake();
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return err;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us){
+	return sim_esp_timer_start(timer, timeout_us, false);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us){
+	return sim_esp_timer_start(timer, period_us, true);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer){
+	esp_err_t err = ESP_OK;
+
+	pthread_mutex_lock(&sim_mtx);
+	if (timer -> active == false){
+		err = ESP_ERR_INVALID_STATE;
+	}
+	timer -> active = false;
+	sim_wake();
+	pthread_mutex_unlock(&sim_mtx);
+	return err;
+}
+
+
+/****************************************************************
+ *
+ * LEDC, every fade is a linear ramp from the present duty
+ *
+ ****************************************************************/
+static uint32_t sim_duty_at(const sim_ch_t *c, int64_t now){
+	if (now >= c -> start + c -> len){
+		return c -> to;
+	}
+	if (now <= c -> start){
+		return c -> from;
+	}
+	return (uint32_t)((int64_t)c -> from +
+			((int64_t)c -> to - (int64_t)c -> from) * (now - c -> start) / c -> len);
+}
+
+static bool sim_ch_lit(const sim_ch_t *c, int64_t now){
+	return (c -> stopped == false) && (sim_ledc_paused == false) &&
+			((sim_duty_at(c, now) > 0) || (now < c -> start + c -> len));
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *conf){
+	return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *conf){
+	pthread_mutex_lock(&sim_mtx);
+	sim_ch_t *c = &sim_ch[conf -> channel];
+
+	memset(c, 0, sizeof(sim_ch_t));
+	c -> from = c -> to = conf -> duty;
+	c -> start = sim_now();
+	pthread_mutex_unlock(&sim_mtx);
+	return ESP_OK;
+}
+
+esp_err_t ledc_fade_func_install(int intr_flags){
+	return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t mode, ledc_channel_t ch, uint32_t duty, int ms){
+	pthread_mutex_lock(&sim_mtx);
+	sim_ch[ch].fade_to = duty;
+	sim_ch[ch].fade_ms = ms;
+	pthread_mutex_unlock(&sim_mtx);
+	return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t mode, ledc_channel_t ch, ledc_fade_mode_t wait){
+	sim_ch_t *c = &sim_ch[ch];
+	uint32_t from, to;
+	int32_t ms;
+
+	pthread_mutex_lock(&sim_mtx);
+	int64_t now = sim_now();
+
+	from = c -> from = sim_duty_at(c, now);
+	to = c -> to = c -> fade_to;
+	ms = c -> fade_ms;
+	c -> start = now;
+	c -> len = (int64_t)ms * 1000;
+	c -> stopped = false;
+	sim_ledc.fades++;
+	if (sim_ledc_paused == true){
+		sim_ledc.dark_fades++;
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	if (sim_ledc_hook != NULL){
+		sim_ledc_hook(ch, from, to, ms);
+	}
+	return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t ch, uint32_t duty){
+	pthread_mutex_lock(&sim_mtx);
+	sim_ch[ch].set_duty = duty;
+	pthread_mutex_unlock(&sim_mtx);
+	return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t ch){
+	sim_ch_t *c = &sim_ch[ch];
+	uint32_t from, to;
+
+	pthread_mutex_lock(&sim_mtx);
+	from = sim_duty_at(c, sim_now());
+	c -> from = c -> to = to = c -> set_duty;
+	c -> start = sim_now();
+	c -> len = 0;
+	c -> stopped = false;
+	sim_ledc.updates++;
+	if (sim_ledc_paused == true){
+		sim_ledc.dark_fades++;
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	if (sim_ledc_hook != NULL){
+		sim_ledc_hook(ch, from, to, 0);
+	}
+	return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t mode, ledc_channel_t ch){
+	uint32_t duty;
+
+	pthread_mutex_lock(&sim_mtx);
+	duty = sim_duty_at(&sim_ch[ch], sim_now());
+	pthread_mutex_unlock(&sim_mtx);
+	return duty;
+}
+
+esp_err_t ledc_stop(ledc_mode_t mode, ledc_channel_t ch, uint32_t idle_level){
+	pthread_mutex_lock(&sim_mtx);
+	if (sim_ch_lit(&sim_ch[ch], sim_now()) == true){
+		sim_ledc.glitches++;
+	}
+	sim_ch[ch].stopped = true;
+	pthread_mutex_unlock(&sim_mtx);
+	return ESP_OK;
+}
+
+esp_err_t ledc_timer_pause(ledc_mode_t mode, ledc_timer_t timer){
+	pthread_mutex_lock(&sim_mtx);
+	for (int i = 0; i < LEDC_CHANNEL_MAX; i++){
+		if (sim_ch_lit(&sim_ch[i], sim_now()) == true){
+			sim_ledc.glitches++;
+		}
+	}
+	sim_ledc_paused = true;
+	pthread_mutex_unlock(&sim_mtx);
+	return ESP_OK;
+}
+
+esp_err_t ledc_timer_resume(ledc_mode_t mode, ledc_timer_t timer){
+	pthread_mutex_lock(&sim_mtx);
+	sim_ledc_paused = false;
+	pthread_mutex_unlock(&sim_mtx);
+	return ESP_OK;
+}
+
+uint32_t sim_ledc_output(int ch){
+	uint32_t duty = 0;
+
+	pthread_mutex_lock(&sim_mtx);
+	if ((sim_ch[ch].stopped == false) && (sim_ledc_paused == false)){
+		duty = sim_duty_at(&sim_ch[ch], sim_now());
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return duty;
+}
+
+bool sim_ledc_fading(void){
+	bool res = false;
+
+	pthread_mutex_lock(&sim_mtx);
+	for (int i = 0; i < LEDC_CHANNEL_MAX; i++){
+		if (sim_now() < sim_ch[i].start + sim_ch[i].len){
+			res = true;
+		}
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return res;
+}
+
+bool sim_ledc_idle(void){
+	bool res;
+
+	pthread_mutex_lock(&sim_mtx);
+	res = sim_ledc_paused && sim_ch[0].stopped && sim_ch[1].stopped;
+	pthread_mutex_unlock(&sim_mtx);
+	return res;
+}
+
+
+/****************************************************************
+ *
+ * power management locks
+ *
+ ****************************************************************/
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int arg, const char *name,
+		esp_pm_lock_handle_t *handle){
+	esp_err_t err = ESP_ERR_NO_MEM;
+
+	pthread_mutex_lock(&sim_mtx);
+	for (int i = 0; i < SIM_PM_LOCKS; i++){
+		if (sim_pm_locks[i].used == false){
+			sim_pm_locks[i].used = true;
+			sim_pm_locks[i].count = 0;
+			*handle = &sim_pm_locks[i];
+			err = ESP_OK;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return err;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle){
+	pthread_mutex_lock(&sim_mtx);
+	handle -> count++;
+	pthread_mutex_unlock(&sim_mtx);
+	return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle){
+	esp_err_t err = ESP_OK;
+
+	pthread_mutex_lock(&sim_mtx);
+	if (handle -> count == 0){
+		err = ESP_ERR_INVALID_STATE;
+		sim_failures++;
+		printf("FAIL sim: power management lock released more than acquired\n");
+	}
+	else{
+		handle -> count--;
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return err;
+}
+
+int sim_pm_held(void){
+	int n = 0;
+
+	pthread_mutex_lock(&sim_mtx);
+	for (int i = 0; i < SIM_PM_LOCKS; i++){
+		n += sim_pm_locks[i].count;
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return n;
+}
+
+
+/****************************************************************
+ *
+ * NVS kept in RAM
+ *
+ ****************************************************************/
+static sim_nvs_t *sim_nvs_find(const char *key, bool create){
+	for (int i = 0; i < SIM_NVS_KEYS; i++){
+		if ((sim_nvs[i].used == true) && (strcmp(sim_nvs[i].key, key) == 0)){
+			return &sim_nvs[i];
+		}
+	}
+	if (create == true){
+		for (int i = 0; i < SIM_NVS_KEYS; i++){
+			if (sim_nvs[i].used == false){
+				sim_nvs[i].used = true;
+				snprintf(sim_nvs[i].key, sizeof(sim_nvs[i].key), "%s", key);
+				return &sim_nvs[i];
+			}
+		}
+	}
+	return NULL;
+}
+
+static esp_err_t sim_nvs_get(const char *key, int32_t *value){
+	esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+	pthread_mutex_lock(&sim_mtx);
+	sim_nvs_t *n = sim_nvs_find(key, false);
+
+	if (n != NULL){
+		*value = n -> value;
+		err = ESP_OK;
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return err;
+}
+
+static esp_err_t sim_nvs_set(const char *key, int32_t value){
+	esp_err_t err = ESP_ERR_NO_MEM;
+
+	pthread_mutex_lock(&sim_mtx);
+	sim_nvs_t *n = sim_nvs_find(key, true);
+
+	if (n != NULL){
+		n -> value = value;
+		err = ESP_OK;
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return err;
+}
+
+esp_err_t nvs_flash_init(void){
+	return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle){
+	*handle = 1;
+	return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle){
+}
+
+esp_err_t nvs_get_i8(nvs_handle handle, const char *key, int8_t *value){
+	int32_t v;
+	esp_err_t err = sim_nvs_get(key, &v);
+
+	if (err == ESP_OK){
+		*value = (int8_t)v;
+	}
+	return err;
+}
+
+esp_err_t nvs_get_i32(nvs_handle handle, const char *key, int32_t *value){
+	return sim_nvs_get(key, value);
+}
+
+esp_err_t nvs_set_i8(nvs_handle handle, const char *key, int8_t value){
+	return sim_nvs_set(key, value);
+}
+
+esp_err_t nvs_set_i32(nvs_handle handle, const char *key, int32_t value){
+	return sim_nvs_set(key, value);
+}
+
+esp_err_t nvs_commit(nvs_handle handle){
+	__atomic_add_fetch(&sim_nvs_commits, 1, __ATOMIC_RELAXED);
+	return ESP_OK;
+}
+
+
+/****************************************************************
+ *
+ * GPIO, interrupt handler runs in the thread changing the level
+ *
+ ****************************************************************/
+esp_err_t gpio_config(const gpio_config_t *conf){
+	for (int i = 0; i < SIM_GPIOS; i++){
+		if (conf -> pin_bit_mask & (1ULL << i)){
+			sim_gpio_level[i] = (conf -> pull_up_en == GPIO_PULLUP_ENABLE) ? 1 : 0;
+		}
+	}
+	return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_flags){
+	if (sim_isr_service == true){
+		return ESP_ERR_INVALID_STATE;
+	}
+	sim_isr_service = true;
+	return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t handler, void *arg){
+	sim_gpio_isr[gpio] = handler;
+	sim_gpio_arg[gpio] = arg;
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio){
+	return __atomic_load_n(&sim_gpio_level[gpio], __ATOMIC_ACQUIRE);
+}
+
+void sim_gpio_set(int gpio, int level){
+	if (gpio_get_level(gpio) == level){
+		return;
+	}
+	__atomic_store_n(&sim_gpio_level[gpio], level, __ATOMIC_RELEASE);
+	if (sim_gpio_isr[gpio] != NULL){
+		sim_gpio_isr[gpio](sim_gpio_arg[gpio]);
+	}
+}
+
+
+/****************************************************************
+ *
+ * system
+ *
+ ****************************************************************/
+const char *esp_err_to_name(esp_err_t err){
+	return (err == ESP_OK) ? "ESP_OK" : "ESP_FAIL";
+}
+
+uint32_t esp_get_free_heap_size(void){
+	struct mallinfo2 mi = mallinfo2();
+
+	return SIM_HEAP_SIZE - (uint32_t)mi.uordblks;
+}
+
+
+/****************************************************************
+ *
+ * Web Thing server, records messages sent to subscribers
+ *
+ ****************************************************************/
+thing_t *thing_init(void){
+	sim_server.allocated++;
+	return calloc(1, sizeof(thing_t));
+}
+
+void set_thing_type(thing_t *thing, at_type_t *type){
+}
+
+property_t *property_init(char *next_prop, char *id){
+	sim_server.allocated++;
+	return calloc(1, sizeof(property_t));
+}
+
+void add_property(thing_t *thing, property_t *prop){
+	if (sim_props_number < SIM_PROPS){
+		sim_props[sim_props_number++] = prop;
+	}
+}
+
+action_t *action_init(void){
+	sim_server.allocated++;
+	return calloc(1, sizeof(action_t));
+}
+
+action_input_prop_t *action_input_prop_init(char *id, VAL_TYPE type, bool required,
+		int_float_u *min, int_float_u *max, char *unit, bool enum_prop, enum_item_t *enum_list){
+	sim_server.allocated++;
+	return (action_input_prop_t *)calloc(1, 64);
+}
+
+void add_action_input_prop(action_t *action, action_input_prop_t *prop){
+}
+
+void add_action(thing_t *thing, action_t *action){
+	if (sim_actions_number < SIM_ACTIONS){
+		sim_actions[sim_actions_number++] = action;
+	}
+}
+
+static bool sim_in_led_task(void){
+	return (sim_self != NULL) && (strcmp(sim_self -> name, "leds") == 0);
+}
+
+int8_t complete_action(int8_t thing_nr, char *action_id, action_status_t status){
+	pthread_mutex_lock(&sim_server_mtx);
+	for (int i = 0; i < sim_actions_number; i++){
+		if (strcmp(sim_actions[i] -> id, action_id) == 0){
+			sim_actions_completed[i]++;
+		}
+	}
+	sim_server.completed++;
+	if (sim_in_led_task() == true){
+		sim_server.from_led_task++;
+	}
+	pthread_mutex_unlock(&sim_server_mtx);
+	return 0;
+}
+
+int8_t inform_all_subscribers_prop(property_t *prop){
+	int64_t start = sim_real_us();
+	int32_t delay = __atomic_load_n(&sim_notify_us, __ATOMIC_ACQUIRE);
+
+	if (delay > 0){
+		usleep(delay);
+	}
+	pthread_mutex_lock(&sim_server_mtx);
+	for (int i = 0; i < sim_props_number; i++){
+		if (sim_props[i] == prop){
+			sim_props_notified[i]++;
+		}
+	}
+	sim_server.notifications++;
+	sim_server.notify_us += sim_real_us() - start;
+	if (sim_in_led_task() == true){
+		sim_server.from_led_task++;
+	}
+	pthread_mutex_unlock(&sim_server_mtx);
+	return 0;
+}
+
+void sim_notify_delay(int32_t us){
+	__atomic_store_n(&sim_notify_us, us, __ATOMIC_RELEASE);
+}
+
+property_t *sim_prop(const char *id){
+	for (int i = 0; i < sim_props_number; i++){
+		if (strcmp(sim_props[i] -> id, id) == 0){
+			return sim_props[i];
+		}
+	}
+	fprintf(stderr, "sim: no property %s\n", id);
+	abort();
+}
+
+action_t *sim_action(const char *id){
+	for (int i = 0; i < sim_actions_number; i++){
+		if (strcmp(sim_actions[i] -> id, id) == 0){
+			return sim_actions[i];
+		}
+	}
+	fprintf(stderr, "sim: no action %s\n", id);
+	abort();
+}
+
+uint32_t sim_notified(const char *id){
+	property_t *prop = sim_prop(id);
+	uint32_t n = 0;
+
+	pthread_mutex_lock(&sim_server_mtx);
+	for (int i = 0; i < sim_props_number; i++){
+		if (sim_props[i] == prop){
+			n = sim_props_notified[i];
+		}
+	}
+	pthread_mutex_unlock(&sim_server_mtx);
+	return n;
+}
+
+uint32_t sim_completed(const char *id){
+	action_t *action = sim_action(id);
+	uint32_t n = 0;
+
+	pthread_mutex_lock(&sim_server_mtx);
+	for (int i = 0; i < sim_actions_number; i++){
+		if (sim_actions[i] == action){
+			n = sim_actions_completed[i];
+		}
+	}
+	pthread_mutex_unlock(&sim_server_mtx);
+	return n;
+}
+
+//in frozen mode handlers run in the server task, the caller moves the
+//clock until the handler returns (handlers may wait, e.g. vTaskDelay)
+static void sim_httpd_fun(void *arg){
+	for (;;){
+		xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+		sim_httpd_req.res = sim_httpd_req.fun(sim_httpd_req.arg);
+		pthread_mutex_lock(&sim_mtx);
+		sim_httpd_req.done = true;
+		pthread_cond_broadcast(&sim_cond);
+		pthread_mutex_unlock(&sim_mtx);
+	}
+}
+
+int16_t sim_call(int16_t (*fun)(void *arg), void *arg){
+	if (sim_frozen == false){
+		return fun(arg);
+	}
+	sim_httpd_req.fun = fun;
+	sim_httpd_req.arg = arg;
+	sim_httpd_req.done = false;
+	xTaskNotify(sim_httpd, 1, eSetBits);
+	pthread_mutex_lock(&sim_mtx);
+	for (;;){
+		while ((sim_running > 0) && (sim_httpd_req.done == false)){
+			pthread_cond_wait(&sim_cond, &sim_mtx);
+		}
+		if ((sim_httpd_req.done == true) || (sim_step(SIM_NEVER) == false)){
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim_mtx);
+	return sim_httpd_req.res;
+}
+
+typedef struct {
+	property_t *prop;
+	action_t *action;
+	char buff[256];
+} sim_cmd_t;
+
+static int16_t sim_put_fun(void *arg){
+	sim_cmd_t *cmd = arg;
+
+	return cmd -> prop -> set(cmd -> prop -> id, cmd -> buff);
+}
+
+static int16_t sim_run_fun(void *arg){
+	sim_cmd_t *cmd = arg;
+
+	return cmd -> action -> run(cmd -> buff);
+}
+
+int16_t sim_put(const char *id, const char *value){
+	sim_cmd_t cmd = {.prop = sim_prop(id)};
+
+	snprintf(cmd.buff, sizeof(cmd.buff), "%s", value);
+	return sim_call(sim_put_fun, &cmd);
+}
+
+int16_t sim_run(const char *id, const char *inputs){
+	sim_cmd_t cmd = {.action = sim_action(id)};
+
+	snprintf(cmd.buff, sizeof(cmd.buff), "%s", inputs);
+	return sim_call(sim_run_fun, &cmd);
+}
+
+int sim_prop_int(const char *id){
+	property_t *prop = sim_prop(id);
+
+	if (prop -> type == VAL_BOOLEAN){
+		return *(bool *)prop -> value;
+	}
+	return *(int32_t *)prop -> value;
+}
+
+const char *sim_prop_str(const char *id){
+	return (const char *)sim_prop(id) -> value;
+}
+
+
+/****************************************************************
+ *
+ * sockets
+ *
+ ****************************************************************/
+void sim_port_offset(int offset){
+	sim_port_off = offset;
+}
+
+int sim_port(int port){
+	return port + sim_port_off;
+}
+
+int sim_bind(int s, const struct sockaddr *addr, socklen_t len){
+	struct sockaddr_in a;
+
+	if ((addr -> sa_family != AF_INET) || (len != sizeof(a))){
+		return bind(s, addr, len);
+	}
+	memcpy(&a, addr, sizeof(a));
+	if (a.sin_port != 0){
+		a.sin_port = htons(sim_port(ntohs(a.sin_port)));
+	}
+	return bind(s, (struct sockaddr *)&a, sizeof(a));
+}
+
+
+/****************************************************************
+ *
+ * start of simulation and result
+ *
+ ****************************************************************/
+void sim_init(bool frozen){
+	pthread_condattr_t attr;
+
+	//unbuffered output, printf does not allocate in the command path
+	setvbuf(stdout, NULL, _IONBF, 0);
+	setenv("TZ", "UTC0", 1);
+	tzset();
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sim_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	sim_frozen = frozen;
+	sim_real_start = sim_real_us();
+	for (int i = 0; i < LEDC_CHANNEL_MAX; i++){
+		sim_ch[i].start = sim_now();
+	}
+	sim_timer_task = sim_task_new(sim_timer_fun, "Tmr Svc", 2048, NULL);
+	sim_task_new(sim_esp_timer_fun, "esp_timer", 3584, NULL);
+	if (frozen == true){
+		sim_httpd = sim_task_new(sim_httpd_fun, "httpd", 4096, NULL);
+	}
+	sim_settle();
+}
+
+int sim_done(const char *name){
+	printf("%s: %s\n", name, (sim_failures == 0) ? "PASS" : "FAIL");
+	return (sim_failures == 0) ? 0 : 1;
+}
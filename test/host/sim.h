@@ -0,0 +1,94 @@
+/* *********************************************************
+ * Host simulator of the ESP-IDF services used by the
+ * LED 2 channel controller
+ *
+ * FreeRTOS tasks, mutexes, notifications and timers run on
+ * pthreads, LEDC fades are modelled as linear ramps, NVS is
+ * kept in RAM and the Web Thing server only records what the
+ * component sends to subscribers.
+ *
+ * Two clock modes:
+ *	- real time, virtual clock follows CLOCK_MONOTONIC, used by
+ *	  benchmarks and socket tests
+ *	- frozen, virtual clock moves only in sim_advance(), all
+ *	  tasks run until they block before time goes on, used by
+ *	  deterministic tests of timers, fades and clock steps
+ ************************************************************/
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "simple_web_thing_server.h"
+
+//clock
+void sim_init(bool frozen);
+int64_t sim_now(void);				//virtual time [us], esp_timer clock
+int64_t sim_real_us(void);			//host monotonic time [us]
+void sim_advance(int64_t us);		//move virtual time, frozen: run all due events
+void sim_settle(void);				//frozen: wait until all tasks are blocked
+void sim_set_wall(time_t t);		//step wall clock (time()) to t
+void sim_sleep_ms(int ms);			//real time sleep of the test thread
+
+//LEDC model
+typedef struct {
+	uint32_t fades;			//fades started
+	uint32_t updates;		//direct duty updates
+	uint32_t glitches;		//output cut while light was still on
+	uint32_t dark_fades;	//fades started on paused timer
+} sim_ledc_t;
+extern sim_ledc_t sim_ledc;
+extern void (*sim_ledc_hook)(int ch, uint32_t from, uint32_t to, int32_t ms);
+uint32_t sim_ledc_output(int ch);	//duty seen by the LED driver at this moment
+bool sim_ledc_fading(void);			//any channel still ramping
+bool sim_ledc_idle(void);			//channels stopped and timer paused
+
+//power management
+int sim_pm_held(void);				//number of acquired locks
+
+//NVS
+extern uint32_t sim_nvs_commits;
+
+//GPIO, edge calls ISR handler from the calling thread
+void sim_gpio_set(int gpio, int level);
+
+//Web Thing server
+typedef struct {
+	uint32_t notifications;		//inform_all_subscribers_prop() calls
+	int64_t notify_us;			//time spent in them
+	uint32_t completed;			//complete_action() calls
+	uint32_t from_led_task;		//messages sent by the "leds" task
+	uint32_t allocated;			//objects created by server init functions
+} sim_server_t;
+extern sim_server_t sim_server;
+void sim_notify_delay(int32_t us);	//cost of one message to all subscribers
+property_t *sim_prop(const char *id);
+action_t *sim_action(const char *id);
+uint32_t sim_notified(const char *id);
+uint32_t sim_completed(const char *id);
+int16_t sim_call(int16_t (*fun)(void *arg), void *arg);	//run as server task
+int16_t sim_put(const char *id, const char *value);
+int16_t sim_run(const char *id, const char *inputs);
+int sim_prop_int(const char *id);
+const char *sim_prop_str(const char *id);
+
+//sockets
+void sim_port_offset(int offset);
+int sim_port(int port);				//device port after offset
+
+//checks
+extern int sim_failures;
+#define CHECK(cond, ...) do { \
+	if (!(cond)){ \
+		sim_failures++; \
+		printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+} while (0)
+int sim_done(const char *name);
+
+#endif /* SIM_H_ */
@@ -0,0 +1,4 @@
+#ifndef ESP_LOG_H_
+#define ESP_LOG_H_
+
+#endif /* ESP_LOG_H_ */
@@ -0,0 +1,18 @@
+#ifndef ESP_PM_H_
+#define ESP_PM_H_
+
+#include "esp_system.h"
+
+typedef struct esp_pm_lock *esp_pm_lock_handle_t;
+typedef enum {
+	ESP_PM_CPU_FREQ_MAX,
+	ESP_PM_APB_FREQ_MAX,
+	ESP_PM_NO_LIGHT_SLEEP
+} esp_pm_lock_type_t;
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int arg, const char *name,
+		esp_pm_lock_handle_t *handle);
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle);
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle);
+
+#endif /* ESP_PM_H_ */
@@ -0,0 +1,17 @@
+#ifndef ESP_SYSTEM_H_
+#define ESP_SYSTEM_H_
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+#define ESP_OK					0
+#define ESP_FAIL				-1
+#define ESP_ERR_NO_MEM			0x101
+#define ESP_ERR_INVALID_ARG		0x102
+#define ESP_ERR_INVALID_STATE	0x103
+#define ESP_ERR_NVS_NOT_FOUND	0x1102
+
+const char *esp_err_to_name(esp_err_t err);
+uint32_t esp_get_free_heap_size(void);
+
+#endif /* ESP_SYSTEM_H_ */
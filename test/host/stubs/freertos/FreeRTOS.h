@@ -0,0 +1,55 @@
+/* *********************************************************
+ * Host build stubs: FreeRTOS types and port macros
+ * Implemented by sim.c on top of pthreads
+ ************************************************************/
+#ifndef FREERTOS_H_
+#define FREERTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "esp_attr.h"
+#include "sim_time.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint8_t StackType_t;		//ESP-IDF stack depth is given in bytes
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct sim_task *TaskHandle_t;
+typedef TaskHandle_t xTaskHandle;
+typedef struct sim_sem *SemaphoreHandle_t;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+typedef struct sim_timer *TimerHandle_t;
+
+typedef struct {int x[20];} StaticSemaphore_t;
+typedef struct {int x[100];} StaticTask_t;
+typedef struct {int x[20];} StaticTimer_t;
+
+//spinlocks are mutexes on the host
+typedef struct {pthread_mutex_t m;} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	{PTHREAD_MUTEX_INITIALIZER}
+#define portENTER_CRITICAL(mux)			pthread_mutex_lock(&(mux) -> m)
+#define portEXIT_CRITICAL(mux)			pthread_mutex_unlock(&(mux) -> m)
+#define portENTER_CRITICAL_ISR(mux)		portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)		portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR()			do {} while (0)
+
+#define configTICK_RATE_HZ		100
+#define portTICK_PERIOD_MS		(1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY			((TickType_t)0xffffffffu)
+#define pdMS_TO_TICKS(ms)		((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define configMINIMAL_STACK_SIZE	768
+
+#define pdTRUE		1
+#define pdFALSE		0
+#define pdPASS		1
+#define pdFAIL		0
+
+#define ESP_INTR_FLAG_IRAM		(1 << 10)
+
+#endif /* FREERTOS_H_ */
@@ -0,0 +1,30 @@
+#ifndef TASK_H_
+#define TASK_H_
+
+#include "FreeRTOS.h"
+
+typedef enum {
+	eNoAction = 0,
+	eSetBits,
+	eIncrement,
+	eSetValueWithOverwrite,
+	eSetValueWithoutOverwrite
+} eNotifyAction;
+
+BaseType_t xTaskCreate(TaskFunction_t fun, const char *name, uint32_t stack,
+		void *param, UBaseType_t prio, TaskHandle_t *handle);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fun, const char *name, uint32_t stack,
+		void *param, UBaseType_t prio, StackType_t *stack_buf, StaticTask_t *task_buf);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+		BaseType_t *woken);
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+		uint32_t *value, TickType_t ticks);
+
+#endif /* TASK_H_ */
@@ -0,0 +1,19 @@
+#ifndef TIMERS_H_
+#define TIMERS_H_
+
+#include "FreeRTOS.h"
+
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload,
+		void *id, TimerCallbackFunction_t cb);
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t reload,
+		void *id, TimerCallbackFunction_t cb, StaticTimer_t *buf);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+TaskHandle_t xTimerGetTimerDaemonTaskHandle(void);
+
+#endif /* TIMERS_H_ */
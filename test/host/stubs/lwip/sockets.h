@@ -0,0 +1,15 @@
+#ifndef LWIP_SOCKETS_H_
+#define LWIP_SOCKETS_H_
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+//bind() moves the device ports by sim_port_offset(), several simulated
+//nodes can run on one host
+int sim_bind(int s, const struct sockaddr *addr, socklen_t len);
+#define bind(s, addr, len)		sim_bind(s, addr, len)
+
+#endif /* LWIP_SOCKETS_H_ */
@@ -0,0 +1,20 @@
+#ifndef NVS_FLASH_H_
+#define NVS_FLASH_H_
+
+#include <stdint.h>
+#include "esp_system.h"
+
+typedef uint32_t nvs_handle;
+typedef uint32_t nvs_handle_t;
+typedef enum {NVS_READONLY, NVS_READWRITE} nvs_open_mode;
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle);
+void nvs_close(nvs_handle handle);
+esp_err_t nvs_get_i8(nvs_handle handle, const char *key, int8_t *value);
+esp_err_t nvs_get_i32(nvs_handle handle, const char *key, int32_t *value);
+esp_err_t nvs_set_i8(nvs_handle handle, const char *key, int8_t value);
+esp_err_t nvs_set_i32(nvs_handle handle, const char *key, int32_t value);
+esp_err_t nvs_commit(nvs_handle handle);
+
+#endif /* NVS_FLASH_H_ */
@@ -0,0 +1,74 @@
+/* *********************************************************
+ * Host build: default values of the component options,
+ * every test enables its own feature set with -DCONFIG_...
+ ************************************************************/
+#ifndef SDKCONFIG_H_
+#define SDKCONFIG_H_
+
+#define CONFIG_CHANNEL_A_GPIO			18
+#define CONFIG_CHANNEL_B_GPIO			19
+
+#ifndef CONFIG_LED_CCT_WARM_K
+#define CONFIG_LED_CCT_WARM_K			2700
+#endif
+#ifndef CONFIG_LED_CCT_COOL_K
+#define CONFIG_LED_CCT_COOL_K			6500
+#endif
+#ifndef CONFIG_LED_LEVEL_RATE_HZ
+#define CONFIG_LED_LEVEL_RATE_HZ		10
+#endif
+#ifndef CONFIG_LED_TASK_STACK_SIZE
+#define CONFIG_LED_TASK_STACK_SIZE		3072
+#endif
+#ifndef CONFIG_LED_TASK_PRIORITY
+#define CONFIG_LED_TASK_PRIORITY		5
+#endif
+
+#ifndef CONFIG_LED_CMD_STATS_PERIOD
+#define CONFIG_LED_CMD_STATS_PERIOD		60
+#endif
+
+#ifndef CONFIG_LED_STREAM_PORT
+#define CONFIG_LED_STREAM_PORT			5680
+#endif
+#ifndef CONFIG_LED_STREAM_RATE_HZ
+#define CONFIG_LED_STREAM_RATE_HZ		50
+#endif
+#ifndef CONFIG_LED_STREAM_DEPTH
+#define CONFIG_LED_STREAM_DEPTH			2
+#endif
+#ifndef CONFIG_LED_STREAM_TIMEOUT
+#define CONFIG_LED_STREAM_TIMEOUT		1000
+#endif
+
+#ifndef CONFIG_LED_BINARY_PORT
+#define CONFIG_LED_BINARY_PORT			5681
+#endif
+#ifndef CONFIG_LED_GROUP_ID
+#define CONFIG_LED_GROUP_ID				1
+#endif
+
+#ifndef CONFIG_LED_SWITCH_GPIO
+#define CONFIG_LED_SWITCH_GPIO			4
+#endif
+#ifndef CONFIG_LED_SWITCH_DEBOUNCE_MS
+#define CONFIG_LED_SWITCH_DEBOUNCE_MS	30
+#endif
+#ifndef CONFIG_LED_SWITCH_LONG_MS
+#define CONFIG_LED_SWITCH_LONG_MS		600
+#endif
+
+#ifndef CONFIG_LED_LOAD_A_WATTS
+#define CONFIG_LED_LOAD_A_WATTS			50
+#endif
+#ifndef CONFIG_LED_LOAD_B_WATTS
+#define CONFIG_LED_LOAD_B_WATTS			50
+#endif
+#ifndef CONFIG_LED_LOAD_PSU_WATTS
+#define CONFIG_LED_LOAD_PSU_WATTS		100
+#endif
+#ifndef CONFIG_LED_LOAD_RAMP_MS
+#define CONFIG_LED_LOAD_RAMP_MS			500
+#endif
+
+#endif /* SDKCONFIG_H_ */
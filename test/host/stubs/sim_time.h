@@ -0,0 +1,12 @@
+#ifndef SIM_TIME_H_
+#define SIM_TIME_H_
+
+#include <time.h>
+
+//wall clock of the simulated device, set and stepped by the tests
+time_t sim_time(time_t *t);
+#ifndef SIM_NO_TIME_MACRO
+#define time(t)		sim_time(t)
+#endif
+
+#endif /* SIM_TIME_H_ */
@@ -0,0 +1,82 @@
+/* *********************************************************
+ * Host build stubs: the part of the Web Thing server API
+ * used by the component, implemented by sim.c
+ ************************************************************/
+#ifndef SIMPLE_WEB_THING_SERVER_H_
+#define SIMPLE_WEB_THING_SERVER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+typedef enum {VAL_NULL, VAL_BOOLEAN, VAL_INTEGER, VAL_NUMBER, VAL_STRING} VAL_TYPE;
+typedef enum {ACT_PENDING, ACT_EXECUTING, ACT_COMPLETED} action_status_t;
+
+typedef union {
+	int int_val;
+	double float_val;
+} int_float_u;
+
+typedef struct at_type_t {
+	char *at_type;
+	struct at_type_t *next;
+} at_type_t;
+
+typedef struct enum_item_t {
+	union {
+		char *str_addr;
+		int int_val;
+	} value;
+	struct enum_item_t *next;
+} enum_item_t;
+
+typedef struct property_t {
+	char *id;
+	char *description;
+	at_type_t *at_type;
+	VAL_TYPE type;
+	void *value;
+	char *unit;
+	char *title;
+	bool read_only;
+	bool enum_prop;
+	enum_item_t *enum_list;
+	int_float_u max_value;
+	int_float_u min_value;
+	int16_t (*set)(char *name, char *new_value_str);
+	xSemaphoreHandle mux;
+} property_t;
+
+typedef struct action_input_prop_t action_input_prop_t;
+
+typedef struct action_t {
+	char *id;
+	char *title;
+	char *description;
+	int16_t (*run)(char *inputs);
+	at_type_t *input_at_type;
+} action_t;
+
+typedef struct thing_t {
+	char *id;
+	char *at_context;
+	int model_len;
+	char *description;
+} thing_t;
+
+extern char things_context[];
+
+thing_t *thing_init(void);
+void set_thing_type(thing_t *thing, at_type_t *type);
+property_t *property_init(char *next_prop, char *id);
+void add_property(thing_t *thing, property_t *prop);
+action_t *action_init(void);
+action_input_prop_t *action_input_prop_init(char *id, VAL_TYPE type, bool required,
+		int_float_u *min, int_float_u *max, char *unit, bool enum_prop, enum_item_t *enum_list);
+void add_action_input_prop(action_t *action, action_input_prop_t *prop);
+void add_action(thing_t *thing, action_t *action);
+int8_t complete_action(int8_t thing_nr, char *action_id, action_status_t status);
+int8_t inform_all_subscribers_prop(property_t *prop);
+
+#endif /* SIMPLE_WEB_THING_SERVER_H_ */
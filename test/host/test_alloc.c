@@ -0,0 +1,120 @@
+/* *********************************************************
+ * no heap in the command path, static allocation with most
+ * features enabled:
+ *	- thing, properties and actions are not allocated by the
+ *	  server, only action inputs are
+ *	- after warm-up no malloc/calloc/realloc is called while
+ *	  commands, fades, timers, the wall switch, notifications,
+ *	  diagnostics and statistics run
+ * malloc family is replaced, every call in the counted window
+ * is reported with its caller
+ ************************************************************/
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+#define CALLERS		16
+static volatile bool counting = false;
+static uint32_t allocs = 0;
+static void *callers[CALLERS];
+
+static void alloc_count(void *caller){
+	if (counting == true){
+		uint32_t n = __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+
+		if (n < CALLERS){
+			callers[n] = caller;
+		}
+	}
+}
+
+void *malloc(size_t size){
+	alloc_count(__builtin_return_address(0));
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size){
+	alloc_count(__builtin_return_address(0));
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size){
+	alloc_count(__builtin_return_address(0));
+	return __libc_realloc(p, size);
+}
+
+void free(void *p){
+	__libc_free(p);
+}
+
+static void switch_press(int64_t ms){
+	sim_gpio_set(CONFIG_LED_SWITCH_GPIO, 1);
+	sim_advance(ms * 1000);
+	sim_gpio_set(CONFIG_LED_SWITCH_GPIO, 0);
+	sim_advance(100000);
+}
+
+//every command path once
+static void commands(int i){
+	char buff[96];
+
+	sim_put("on", "true");
+	sim_advance(50000);
+	snprintf(buff, sizeof(buff), "%d", 20 + (i * 7) % 80);
+	sim_put("brightness", buff);
+	sim_advance(1500000);
+	sim_put("channel", channel_tab[i % CH_NUMBER]);
+	sim_advance(1500000);
+	snprintf(buff, sizeof(buff), "%d", CCT_WARM + (i * 300) % (CCT_COOL - CCT_WARM));
+	sim_put("color-temperature", buff);
+	sim_advance(1500000);
+	snprintf(buff, sizeof(buff), "%d", 200 + (i * 100) % 800);
+	sim_put("fade-time", buff);
+	sim_advance(100000);
+	snprintf(buff, sizeof(buff), "{\"on\":true,\"channel\":\"CCT\",\"brightness\":%d,"
+			"\"color-temperature\":%d}", 30 + i % 60, CCT_WARM + i * 50);
+	sim_run("apply", buff);
+	sim_advance(1500000);
+	switch_press(100);		//OFF
+	sim_advance(1500000);
+	switch_press(100);		//ON
+	switch_press(1500);		//dimming
+	sim_advance(1500000);
+	sim_put("on", "false");
+	sim_advance(1500000);
+	sim_run("timer", "{\"duration\":1}");
+	sim_advance(62000000);
+}
+
+int main(void){
+	uint32_t inputs = sizeof(timer_inputs) / sizeof(input_desc_t) +
+					sizeof(apply_inputs) / sizeof(input_desc_t);
+
+	sim_init(true);
+	init_led_2_channels();
+	sim_advance(6000000);
+	CHECK(sim_server.allocated == inputs, "%u server objects allocated, %u inputs",
+			sim_server.allocated, inputs);
+
+	commands(0);
+	counting = true;
+	for (int i = 1; i < 10; i++){
+		commands(i);
+	}
+	sim_advance(120000000);
+	counting = false;
+
+	CHECK(sim_completed("timer") == 10, "%u timers completed", sim_completed("timer"));
+	CHECK(sim_completed("apply") == 10, "%u applies completed", sim_completed("apply"));
+	CHECK(sim_server.notifications > 200, "only %u notifications", sim_server.notifications);
+	CHECK(allocs == 0, "%u allocations in the command path", allocs);
+	for (int i = 0; (i < allocs) && (i < CALLERS); i++){
+		printf("  allocation from %p\n", callers[i]);
+	}
+
+	return sim_done("test_alloc");
+}
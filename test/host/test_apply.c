@@ -0,0 +1,87 @@
+/* *********************************************************
+ * apply action: one transition, every changed property is
+ * sent to subscribers exactly once, unchanged ones are not,
+ * the action completes when the fade is finished
+ ************************************************************/
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+static const char *ids[] = {"on", "channel", "brightness", "fade-time",
+							"color-temperature"};
+#define IDS_NUMBER (sizeof(ids) / sizeof(ids[0]))
+
+static void snapshot(uint32_t *n){
+	for (int i = 0; i < IDS_NUMBER; i++){
+		n[i] = sim_notified(ids[i]);
+	}
+}
+
+int main(void){
+	uint32_t before[IDS_NUMBER], after[IDS_NUMBER], fades;
+	int brgh;
+
+	sim_init(true);
+	init_led_2_channels();
+	sim_advance(100000);
+
+	//several properties in one request
+	brgh = (sim_prop_int("brightness") == 60) ? 70 : 60;
+	char req[128];
+	snprintf(req, sizeof(req), "{\"on\":true,\"channel\":\"CCT\",\"brightness\":%d,"
+			"\"fade-time\":500,\"color-temperature\":4000}", brgh);
+	snapshot(before);
+	fades = sim_ledc.fades;
+	CHECK(sim_run("apply", req) == 0, "apply rejected");
+	sim_settle();
+	snapshot(after);
+	for (int i = 0; i < IDS_NUMBER; i++){
+		CHECK(after[i] - before[i] <= 1, "%s sent %u times", ids[i], after[i] - before[i]);
+	}
+	CHECK(after[0] - before[0] == 1, "on not sent");
+	CHECK(after[2] - before[2] == 1, "brightness not sent");
+	CHECK(sim_prop_int("on") == 1, "not ON");
+	CHECK(strcmp(sim_prop_str("channel"), "CCT") == 0, "channel %s", sim_prop_str("channel"));
+	CHECK(sim_prop_int("brightness") == brgh, "brightness %d", sim_prop_int("brightness"));
+	CHECK(sim_prop_int("color-temperature") == 4000, "cct %d",
+			sim_prop_int("color-temperature"));
+	CHECK(sim_ledc.fades - fades == 2, "%u fades, one per channel expected",
+			sim_ledc.fades - fades);
+	CHECK(sim_completed("apply") == 0, "completed before the fade finished");
+
+	sim_advance(1000000);
+	CHECK(sim_completed("apply") == 1, "not completed after the fade");
+
+	//the same values again, nothing changes and nothing is sent
+	snapshot(before);
+	fades = sim_ledc.fades;
+	CHECK(sim_run("apply", req) == 0, "repeated apply rejected");
+	sim_advance(100000);
+	snapshot(after);
+	for (int i = 0; i < IDS_NUMBER; i++){
+		CHECK(after[i] == before[i], "unchanged %s sent", ids[i]);
+	}
+	CHECK(sim_ledc.fades == fades, "fade started without change");
+	CHECK(sim_completed("apply") == 2, "repeated apply not completed");
+
+	//invalid input changes nothing
+	snapshot(before);
+	CHECK(sim_run("apply", "{\"on\":false,\"channel\":\"C\"}") < 0, "invalid channel accepted");
+	sim_advance(100000);
+	snapshot(after);
+	CHECK(memcmp(before, after, sizeof(before)) == 0, "invalid apply sent properties");
+	CHECK(sim_prop_int("on") == 1, "invalid apply switched OFF");
+
+	//numbers are not quoted and not followed by other characters
+	CHECK(sim_run("apply", "{\"on\":false,\"brightness\":\"80\",\"fade-time\":\"fast\"}") < 0,
+			"quoted numbers accepted");
+	CHECK(sim_run("apply", "{\"on\":false,\"fade-time\":fast}") < 0, "fade time fast accepted");
+	CHECK(sim_run("apply", "{\"on\":false,\"brightness\":80x}") < 0, "brightness 80x accepted");
+	sim_advance(100000);
+	snapshot(after);
+	CHECK(memcmp(before, after, sizeof(before)) == 0, "invalid number sent properties");
+	CHECK(sim_prop_int("on") == 1, "invalid number switched OFF");
+	CHECK(sim_prop_int("brightness") == brgh, "brightness %d after invalid number",
+			sim_prop_int("brightness"));
+
+	return sim_done("test_apply");
+}
@@ -0,0 +1,152 @@
+/* *********************************************************
+ * binary control over loopback UDP:
+ *	- every operation changes the state, the response carries
+ *	  the new state and subscribers are informed
+ *	- out of range values are limited, invalid ones rejected,
+ *	  commands during a fade are rejected as busy
+ *	- a retransmitted request (same client, sequence number and
+ *	  operation) is answered from the cache, not executed again,
+ *	  for all BIN_CLIENTS clients
+ *	- malformed records get no response
+ *	- the response is not delayed by slow subscribers
+ ************************************************************/
+#include <unistd.h>
+
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+static struct sockaddr_in dev = {.sin_family = AF_INET};
+
+static int client_new(void){
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	struct timeval tv = {.tv_sec = 0, .tv_usec = 300000};
+
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return sock;
+}
+
+//send raw record, output: response length, 0 - no response
+static int send_raw(int sock, const void *buf, int len, bin_resp_t *resp){
+	int n;
+
+	sendto(sock, buf, len, 0, (struct sockaddr *)&dev, sizeof(dev));
+	n = recv(sock, resp, sizeof(bin_resp_t), 0);
+	return (n < 0) ? 0 : n;
+}
+
+//one request, output: status, -2 if no valid response
+static int request(int sock, uint8_t op, uint16_t seq, int32_t value, bin_resp_t *resp){
+	bin_req_t req = {.magic = BIN_MAGIC, .op = op, .seq = seq, .value = value};
+
+	memset(resp, 0, sizeof(bin_resp_t));
+	if ((send_raw(sock, &req, sizeof(req), resp) != sizeof(bin_resp_t)) ||
+		(resp -> magic != BIN_MAGIC) || (resp -> seq != seq) || (resp -> op != op)){
+		return -2;
+	}
+	return resp -> status;
+}
+
+int main(void){
+	bin_resp_t r, cached;
+	bin_req_t req;
+	int c[BIN_CLIENTS], sock;
+	uint32_t sent;
+	int64_t t;
+
+	sim_init(false);
+	sim_port_offset(20000 + getpid() % 20000);
+	init_led_2_channels();
+	sim_sleep_ms(300);
+	dev.sin_port = htons(sim_port(CONFIG_LED_BINARY_PORT));
+	dev.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sock = client_new();
+
+	//state and every operation
+	CHECK(request(sock, BIN_OP_GET, 1, 0, &r) == 0, "get status %d", r.status);
+	CHECK(r.on == 0, "ON after start");
+	CHECK(request(sock, BIN_OP_FADE, 2, 50, &r) >= 0, "fade time rejected");
+	CHECK(r.fade_time == 100, "fade time %u not limited", r.fade_time);
+	CHECK(request(sock, BIN_OP_CHANNEL, 3, CH_CCT, &r) >= 0, "channel rejected");
+	CHECK(r.channel == CH_CCT, "channel %u", r.channel);
+	CHECK(request(sock, BIN_OP_CCT, 4, 99999, &r) >= 0, "cct rejected");
+	CHECK(r.color_temp == CCT_COOL, "cct %u not limited", r.color_temp);
+	sent = sim_notified("on");
+	CHECK(request(sock, BIN_OP_ON, 5, 1, &r) == 1, "ON status %d", r.status);
+	CHECK((r.on == 1) && (sim_prop_int("on") == 1), "not ON");
+	sim_sleep_ms(300);
+	CHECK(sim_notified("on") == sent + 1, "ON not sent to subscribers");
+	CHECK(request(sock, BIN_OP_BRIGHTNESS, 6, 150, &r) == 1, "brightness status %d", r.status);
+	CHECK(r.brightness == 100, "brightness %u not limited", r.brightness);
+
+	//busy during the fade, a retransmission gets the same answer
+	CHECK(request(sock, BIN_OP_BRIGHTNESS, 7, 20, &r) == -1, "brightness accepted during fade");
+	sim_sleep_ms(300);
+	CHECK(request(sock, BIN_OP_BRIGHTNESS, 7, 20, &r) == -1, "retransmission executed");
+	CHECK(sim_prop_int("brightness") == 100, "brightness %d", sim_prop_int("brightness"));
+
+	//invalid values and operations
+	CHECK(request(sock, BIN_OP_ON, 8, 2, &r) == -1, "ON value 2 accepted");
+	CHECK(request(sock, BIN_OP_CHANNEL, 9, CH_NUMBER, &r) == -1, "channel %d accepted",
+			CH_NUMBER);
+	CHECK(request(sock, 42, 10, 0, &r) == -1, "unknown operation accepted");
+	CHECK(request(sock, BIN_OP_TIMER, 11, 0, &r) == -1, "timer 0 accepted");
+	CHECK(request(sock, BIN_OP_TIMER, 12, 1, &r) == 1, "timer rejected");
+	CHECK(xTimerIsTimerActive(timer) == pdTRUE, "timer not running");
+
+	//malformed records are ignored
+	req = (bin_req_t){.magic = 0x1234, .op = BIN_OP_ON, .seq = 13, .value = 0};
+	CHECK(send_raw(sock, &req, sizeof(req), &r) == 0, "wrong magic answered");
+	req.magic = BIN_MAGIC;
+	CHECK(send_raw(sock, &req, sizeof(req) - 1, &r) == 0, "short record answered");
+	CHECK(sim_prop_int("on") == 1, "malformed record executed");
+
+	//retransmissions of every remembered client
+	for (int i = 0; i < BIN_CLIENTS; i++){
+		c[i] = client_new();
+		CHECK(request(c[i], BIN_OP_BRIGHTNESS, 100, 10 + i * 10, &r) == 1,
+				"client %d: status %d", i, r.status);
+		sim_sleep_ms(300);
+	}
+	CHECK(sim_prop_int("brightness") == 10 * BIN_CLIENTS, "brightness %d",
+			sim_prop_int("brightness"));
+	sent = sim_notified("brightness");
+	for (int i = 0; i < BIN_CLIENTS; i++){
+		CHECK(request(c[i], BIN_OP_BRIGHTNESS, 100, 10 + i * 10, &cached) == 1,
+				"client %d: retransmission status %d", i, cached.status);
+		CHECK(cached.brightness == 10 + i * 10, "client %d: response not cached", i);
+	}
+	CHECK(sim_prop_int("brightness") == 10 * BIN_CLIENTS, "retransmission executed, "
+			"brightness %d", sim_prop_int("brightness"));
+	CHECK(sim_notified("brightness") == sent, "retransmission sent to subscribers");
+	//new sequence number is executed
+	CHECK(request(c[0], BIN_OP_BRIGHTNESS, 101, 10, &r) == 1, "new request status %d",
+			r.status);
+	CHECK(sim_prop_int("brightness") == 10, "brightness %d", sim_prop_int("brightness"));
+
+	//slow subscribers, messages are sent after the response
+	sim_sleep_ms(300);
+	sim_notify_delay(50000);
+	sent = sim_notified("on");
+	t = sim_real_us();
+	CHECK(request(sock, BIN_OP_ON, 102, 0, &r) == 1, "OFF status %d", r.status);
+	t = sim_real_us() - t;
+	printf("OFF response with 50 ms subscriber messages: %" PRId64 " us\n", t);
+	CHECK(t < 10000, "OFF response after %" PRId64 " us", t);
+	sim_sleep_ms(500);
+	xTimerStop(timer, 0);
+	timer_is_running = false;
+	t = sim_real_us();
+	CHECK(request(sock, BIN_OP_TIMER, 103, 1, &r) == 1, "timer status %d", r.status);
+	t = sim_real_us() - t;
+	printf("timer response with 50 ms subscriber messages: %" PRId64 " us\n", t);
+	CHECK(t < 10000, "timer response after %" PRId64 " us", t);
+	sim_sleep_ms(300);
+	CHECK(sim_notified("on") == sent + 2, "ON sent %u times", sim_notified("on") - sent);
+	sim_notify_delay(0);
+
+	for (int i = 0; i < BIN_CLIENTS; i++){
+		close(c[i]);
+	}
+	close(sock);
+	return sim_done("test_binary");
+}
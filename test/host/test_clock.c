@@ -0,0 +1,167 @@
+/* *********************************************************
+ * daily ON time with wall clock steps:
+ *	- minutes are counted before the first SNTP synchronization
+ *	  and kept when the clock jumps from 1970 to the present
+ *	- backward and forward steps inside the day do not change
+ *	  the count
+ *	- the counter is reset at midnight when the LED task wakes
+ *	  at the midnight deadline, with the light ON and OFF
+ *	- random ON/OFF sequences over several days with steps are
+ *	  compared with the expected sum of every day
+ ************************************************************/
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+#define MIN_US		60000000LL
+#define DAY_S		86400
+
+static int64_t wall_set_us;		//wall clock at the last step [us]
+static int64_t wall_set_now;	//virtual time of the last step [us]
+
+static int64_t wall_us(void){
+	return wall_set_us + sim_now() - wall_set_now;
+}
+
+static void wall_set(time_t t){
+	wall_set_us = (int64_t)t * 1000000;
+	wall_set_now = sim_now();
+	sim_set_wall(t);
+}
+
+static void wall_step(int64_t s){
+	wall_set((time_t)(wall_us() / 1000000 + s));
+}
+
+//advance to the given second of the current wall clock day
+static void advance_to(int64_t day_s){
+	int64_t day_start = wall_us() / 1000000 / DAY_S * DAY_S;
+	int64_t target = (day_start + day_s) * 1000000;
+
+	if (target > wall_us()){
+		sim_advance(target - wall_us());
+	}
+}
+
+//ON time expected in the current day
+static bool light_on = false;
+static int64_t expected_us = 0, on_since = 0;
+
+static void light(bool on){
+	if (on == light_on){
+		return;
+	}
+	CHECK(sim_put("on", on ? "true" : "false") == 1, "ON/OFF rejected");
+	if (on == false){
+		expected_us += sim_now() - on_since;
+	}
+	on_since = sim_now();
+	light_on = on;
+}
+
+static int expected_min(void){
+	return (expected_us + (light_on ? sim_now() - on_since : 0)) / MIN_US;
+}
+
+//midnight passed at wall clock midnight, the new day starts there
+static void new_day(int64_t midnight_now){
+	expected_us = 0;
+	if (light_on == true){
+		on_since = midnight_now;
+	}
+}
+
+int main(void){
+	unsigned seed = 20261019;
+	uint32_t sent;
+
+	sim_init(true);
+	init_led_2_channels();
+	CHECK(sim_put("channel", "A") >= 0, "channel rejected");
+	CHECK(sim_put("fade-time", "100") >= 0, "fade time rejected");
+	sim_advance(6000000);
+
+	//before SNTP, wall clock in 1970
+	light(true);
+	sim_advance(30 * MIN_US + 500000);
+	CHECK(sim_prop_int("daily-on") == 30, "%d min before SNTP", sim_prop_int("daily-on"));
+
+	//first synchronization, 2026-10-19 12:00:00 UTC
+	wall_set(1792411200);
+	sim_advance(1000000);
+	CHECK(sim_prop_int("daily-on") == 30, "%d min after SNTP step", sim_prop_int("daily-on"));
+	sim_advance(10 * MIN_US);
+	CHECK(sim_prop_int("daily-on") == 40, "%d min after SNTP", sim_prop_int("daily-on"));
+
+	//steps inside the day
+	wall_step(-3600);
+	sim_advance(5 * MIN_US);
+	CHECK(sim_prop_int("daily-on") == 45, "%d min after backward step",
+			sim_prop_int("daily-on"));
+	wall_step(2 * 3600);
+	sim_advance(5 * MIN_US);
+	CHECK(sim_prop_int("daily-on") == 50, "%d min after forward step",
+			sim_prop_int("daily-on"));
+
+	//midnight with the light ON
+	advance_to(DAY_S - 30);
+	CHECK(sim_prop_int("daily-on") > 50, "%d min before midnight", sim_prop_int("daily-on"));
+	sent = sim_notified("daily-on");
+	advance_to(DAY_S + 1);
+	CHECK(sim_prop_int("daily-on") == 0, "%d min after midnight, light ON",
+			sim_prop_int("daily-on"));
+	CHECK(sim_notified("daily-on") > sent, "reset not sent");
+	sim_advance(2 * MIN_US);
+	CHECK(sim_prop_int("daily-on") == 2, "%d min after midnight", sim_prop_int("daily-on"));
+
+	//midnight with the light OFF, the LED task sleeps until the deadline
+	light(false);
+	advance_to(DAY_S - 30);
+	CHECK(sim_ledc_idle() == true, "LEDC not idle");
+	advance_to(DAY_S + 1);
+	CHECK(sim_prop_int("daily-on") == 0, "%d min after midnight, light OFF",
+			sim_prop_int("daily-on"));
+
+	//forward step while OFF, midnight must follow the wall clock
+	advance_to(23 * 3600);
+	light(true);
+	sim_advance(10 * MIN_US);
+	light(false);
+	sim_advance(MIN_US);
+	wall_step(40 * 60);
+	advance_to(DAY_S + 1);
+	CHECK(sim_prop_int("daily-on") == 0, "%d min after midnight, stepped forward",
+			sim_prop_int("daily-on"));
+
+	//random ON/OFF sequences with clock steps over 5 days
+	expected_us = 0;
+	for (int day = 0; day < 5; day++){
+		int64_t day_start = wall_us() / 1000000 / DAY_S * DAY_S;
+		bool stepped_back = false, stepped_fwd = false;
+
+		while (wall_us() / 1000000 - day_start < DAY_S - 3600){
+			int64_t left = DAY_S - 3600 - (wall_us() / 1000000 - day_start);
+			int64_t t = 1 + rand_r(&seed) % 7200;
+
+			light((rand_r(&seed) & 1) != 0);
+			sim_advance(((t < left) ? t : left) * 1000000LL);
+			if ((stepped_back == false) && (wall_us() / 1000000 - day_start > 8 * 3600)){
+				wall_step(-(1 + rand_r(&seed) % 1800));
+				stepped_back = true;
+			}
+			if ((stepped_fwd == false) && (wall_us() / 1000000 - day_start > 16 * 3600)){
+				wall_step(1 + rand_r(&seed) % 1800);
+				stepped_fwd = true;
+			}
+		}
+		advance_to(DAY_S - 30);
+		CHECK(sim_prop_int("daily-on") == expected_min(), "day %d: %d min, expected %d",
+				day, sim_prop_int("daily-on"), expected_min());
+		advance_to(DAY_S);
+		new_day(sim_now());
+		sim_advance(61500000);
+		CHECK(sim_prop_int("daily-on") == expected_min(), "day %d after midnight: %d min, "
+				"expected %d", day, sim_prop_int("daily-on"), expected_min());
+	}
+
+	return sim_done("test_clock");
+}
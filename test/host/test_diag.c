@@ -0,0 +1,51 @@
+/* *********************************************************
+ * diagnostics when the socket tasks fail, both UDP ports are
+ * taken before start:
+ *	- stream and binary tasks delete themselves and clear
+ *	  their handles
+ *	- diagnostics are updated without touching deleted tasks,
+ *	  the stopped tasks are not listed
+ ************************************************************/
+#include <unistd.h>
+
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+static int port_take(int port){
+	struct sockaddr_in a = {.sin_family = AF_INET};
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+	a.sin_addr.s_addr = htonl(INADDR_ANY);
+	a.sin_port = htons(port);		//moved by the port offset as the device ports
+	CHECK(bind(sock, (struct sockaddr *)&a, sizeof(a)) == 0, "port %d not taken", port);
+	return sock;
+}
+
+int main(void){
+	int stream_sock, bin_sock;
+
+	sim_init(false);
+	sim_port_offset(20000 + getpid() % 20000);
+	stream_sock = port_take(CONFIG_LED_STREAM_PORT);
+	bin_sock = port_take(CONFIG_LED_BINARY_PORT);
+	init_led_2_channels();
+	sim_sleep_ms(300);
+
+	CHECK(stream_task == NULL, "stream task handle not cleared");
+	CHECK(bin_task == NULL, "binary task handle not cleared");
+	diag_update();
+	sim_sleep_ms(100);
+	printf("diagnostics: %s\n", sim_prop_str("diagnostics"));
+	CHECK(strstr(sim_prop_str("diagnostics"), "stack leds:") != NULL, "no stack of LED task");
+	CHECK(strstr(sim_prop_str("diagnostics"), "stream:") == NULL, "stopped stream task listed");
+	CHECK(strstr(sim_prop_str("diagnostics"), "bin:") == NULL, "stopped binary task listed");
+
+	//still working
+	CHECK(sim_put("on", "true") == 1, "ON rejected");
+	sim_sleep_ms(1500);
+	diag_update();
+
+	close(stream_sock);
+	close(bin_sock);
+	return sim_done("test_diag");
+}
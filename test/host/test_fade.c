@@ -0,0 +1,51 @@
+/* *********************************************************
+ * fade replaced while running: the wall switch turns the
+ * light OFF in the middle of a long fade in
+ *	- the fade timer follows the new fade, commands are
+ *	  rejected until it really ends
+ *	- LEDC is stopped only after the outputs are dark, never
+ *	  at the deadline of the replaced fade
+ ************************************************************/
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+int main(void){
+	sim_init(true);
+	init_led_2_channels();
+	sim_advance(100000);
+	CHECK(sim_put("channel", "A") >= 0, "channel rejected");
+	CHECK(sim_put("brightness", "100") >= 0, "brightness rejected");
+	CHECK(sim_put("fade-time", "2000") >= 0, "fade time rejected");
+	sim_advance(100000);
+
+	for (int i = 0; i < 3; i++){
+		//t = 0, fade in for 2 s
+		CHECK(sim_put("on", "true") == 1, "ON rejected");
+		sim_advance(500000);
+
+		//short press at 0.5 s, OFF on release at 0.6 s, fade out until 2.6 s
+		sim_gpio_set(CONFIG_LED_SWITCH_GPIO, 1);
+		sim_advance(100000);
+		sim_gpio_set(CONFIG_LED_SWITCH_GPIO, 0);
+		sim_advance(10000);
+		CHECK(device_is_on == false, "switch did not turn OFF");
+
+		//deadline of the replaced fade
+		sim_advance(2100000 - 610000);
+		CHECK(sim_ledc_output(0) > 0, "dark at 2.1 s, fade out cut");
+		CHECK(sim_ledc_idle() == false, "LEDC stopped during fade out");
+		CHECK(fade_is_running == true, "fade finished at the old deadline");
+		CHECK(sim_put("brightness", "50") < 0, "command accepted during fade out");
+
+		sim_advance(700000);
+		CHECK(sim_ledc_output(0) == 0, "light after fade out");
+		CHECK(sim_ledc_idle() == true, "LEDC running after fade out");
+		CHECK(fade_is_running == false, "fade not finished");
+		CHECK(sim_put("brightness", "100") >= 0, "command rejected after fade");
+		sim_advance(1000000);
+	}
+	CHECK(sim_ledc.glitches == 0, "%u outputs cut while lit", sim_ledc.glitches);
+	CHECK(sim_ledc.dark_fades == 0, "%u fades on stopped timer", sim_ledc.dark_fades);
+
+	return sim_done("test_fade");
+}
@@ -0,0 +1,193 @@
+/* *********************************************************
+ * group sync of several devices, every node is a separate
+ * process with its own ports and esp_timer clock offset, the
+ * test process is the gateway:
+ *	- clocks are synchronized with exchanges with random
+ *	  asymmetric delays, the group command is sent to the
+ *	  nodes one by one with random gaps
+ *	- fades of all nodes start within a fraction of a stream
+ *	  frame of each other and of the requested instant
+ *	  (CLOCK_MONOTONIC is common to all processes)
+ *	- broadcasts for other groups do not take client slots,
+ *	  the retransmission cache of real clients is kept
+ ************************************************************/
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+#define NODES		4
+#define GW_OFFSET	((int64_t)123456789)		//gateway clock - host clock [us]
+#define START_US	300000			//start time ahead of the command
+#define FRAME_US	20000			//one frame at 50 Hz
+#define NODE_RUN_MS	3000
+
+static int port_base;
+static unsigned seed = 37;
+
+static volatile int64_t fade_at = 0;
+
+static void ledc_hook(int ch, uint32_t from, uint32_t to, int32_t ms){
+	if ((ms > 0) && (fade_at == 0)){
+		fade_at = sim_real_us();
+	}
+}
+
+//device process, reports the host time of its first fade
+static void node(int i, int out){
+	sim_init(false);
+	sim_port_offset(port_base + i * 2);
+	sim_advance((int64_t)(i + 1) * 7777777 + i * 1234);		//own clock
+	init_led_2_channels();
+	sim_put("channel", "A");
+	sim_ledc_hook = ledc_hook;
+	sim_sleep_ms(NODE_RUN_MS);
+	write(out, (const void *)&fade_at, sizeof(fade_at));
+	close(out);
+	exit(sim_failures);
+}
+
+static int64_t gw_now(void){
+	return sim_real_us() + GW_OFFSET;
+}
+
+static struct sockaddr_in node_addr(int i){
+	struct sockaddr_in a = {.sin_family = AF_INET};
+
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	a.sin_port = htons(CONFIG_LED_BINARY_PORT + port_base + i * 2);
+	return a;
+}
+
+static int client_new(void){
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	struct timeval tv = {.tv_sec = 0, .tv_usec = 300000};
+
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return sock;
+}
+
+//network delay of the gateway side, 0 .. 3 ms
+static void net_delay(void){
+	usleep(rand_r(&seed) % 3000);
+}
+
+static void sync_node(int sock, int i){
+	struct sockaddr_in a = node_addr(i);
+	bin_time_t t, r;
+
+	for (int n = 0; n < SYNC_SAMPLES; n++){
+		t = (bin_time_t){.magic = BIN_MAGIC, .op = BIN_OP_SYNC, .seq = n};
+		t.t_a = gw_now();
+		net_delay();
+		sendto(sock, &t, sizeof(t), 0, (struct sockaddr *)&a, sizeof(a));
+		if (recv(sock, &r, sizeof(r), 0) != sizeof(r)){
+			CHECK(false, "node %d: no sync response", i);
+			continue;
+		}
+		net_delay();
+		r.op = BIN_OP_SYNC_RESULT;
+		r.t_b = gw_now();
+		r.t_a = t.t_a;
+		sendto(sock, &r, sizeof(r), 0, (struct sockaddr *)&a, sizeof(a));
+		usleep(2000);
+	}
+}
+
+static int bin_request(int sock, int i, uint8_t op, uint16_t seq, int32_t value,
+		bin_resp_t *resp){
+	struct sockaddr_in a = node_addr(i);
+	bin_req_t req = {.magic = BIN_MAGIC, .op = op, .seq = seq, .value = value};
+
+	sendto(sock, &req, sizeof(req), 0, (struct sockaddr *)&a, sizeof(a));
+	if (recv(sock, resp, sizeof(bin_resp_t), 0) != sizeof(bin_resp_t)){
+		return -2;
+	}
+	return resp -> status;
+}
+
+static void group_send(int sock, int i, uint8_t group, int64_t start){
+	struct sockaddr_in a = node_addr(i);
+	bin_group_t g = {.magic = BIN_MAGIC, .op = BIN_OP_GROUP, .group = group, .seq = 1,
+			.start = start, .mask = LIGHT_ON | LIGHT_BRGH | LIGHT_FADE,
+			.on = 1, .brightness = 80, .fade_time = 500};
+
+	sendto(sock, &g, sizeof(g), 0, (struct sockaddr *)&a, sizeof(a));
+}
+
+int main(void){
+	int pipes[NODES][2], sock, status, cl[BIN_CLIENTS + 1];
+	pid_t pid[NODES];
+	int64_t start, at[NODES], lo = INT64_MAX, hi = INT64_MIN;
+	bin_resp_t r, cached;
+
+	port_base = 20000 + getpid() % 20000;
+	for (int i = 0; i < NODES; i++){
+		pipe(pipes[i]);
+		pid[i] = fork();
+		if (pid[i] == 0){
+			close(pipes[i][0]);
+			node(i, pipes[i][1]);
+		}
+		close(pipes[i][1]);
+	}
+	usleep(300000);
+	sock = client_new();
+
+	//retransmission cache of node 0 with broadcasts for other group
+	for (int i = 0; i <= BIN_CLIENTS; i++){
+		cl[i] = client_new();
+	}
+	CHECK(bin_request(cl[0], 0, BIN_OP_FADE, 10, 200, &r) == 1, "fade time status %d",
+			r.status);
+	for (int i = 1; i <= BIN_CLIENTS; i++){
+		group_send(cl[i], 0, CONFIG_LED_GROUP_ID + 1, gw_now());
+		CHECK(recv(cl[i], &r, sizeof(r), 0) < 0, "other group answered");
+	}
+	//executed again it would report no change
+	CHECK(bin_request(cl[0], 0, BIN_OP_FADE, 10, 200, &cached) == 1,
+			"retransmission status %d, cache evicted", cached.status);
+	CHECK(bin_request(cl[1], 0, BIN_OP_FADE, 1, 300, &r) == 1, "fade time status %d",
+			r.status);
+	//the answer of the first request is still cached, not executed again
+	CHECK(bin_request(cl[0], 0, BIN_OP_FADE, 10, 200, &cached) == 1,
+			"retransmission status %d", cached.status);
+	CHECK(cached.fade_time == 200, "cached fade time %u", cached.fade_time);
+	CHECK(bin_request(cl[2], 0, BIN_OP_GET, 1, 0, &r) == 0, "get status %d", r.status);
+	CHECK(r.fade_time == 300, "retransmission executed, fade time %u", r.fade_time);
+	for (int i = 0; i <= BIN_CLIENTS; i++){
+		close(cl[i]);
+	}
+
+	//clock sync and one group transition
+	for (int i = 0; i < NODES; i++){
+		sync_node(sock, i);
+	}
+	start = gw_now() + START_US;
+	for (int i = 0; i < NODES; i++){
+		group_send(sock, i, CONFIG_LED_GROUP_ID, start);
+		CHECK((recv(sock, &r, sizeof(r), 0) == sizeof(r)) && (r.status == 1),
+				"node %d: group status %d", i, r.status);
+		usleep(rand_r(&seed) % 10000);
+	}
+
+	for (int i = 0; i < NODES; i++){
+		at[i] = 0;
+		read(pipes[i][0], &at[i], sizeof(at[i]));
+		waitpid(pid[i], &status, 0);
+		CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0), "node %d failed", i);
+		CHECK(at[i] != 0, "node %d: no fade", i);
+		printf("node %d: start %+" PRId64 " us\n", i, at[i] - (start - GW_OFFSET));
+		CHECK(llabs(at[i] - (start - GW_OFFSET)) < FRAME_US / 4,
+				"node %d: %" PRId64 " us from the requested start", i,
+				at[i] - (start - GW_OFFSET));
+		lo = (at[i] < lo) ? at[i] : lo;
+		hi = (at[i] > hi) ? at[i] : hi;
+	}
+	printf("start spread of %d nodes: %" PRId64 " us\n", NODES, hi - lo);
+	CHECK(hi - lo < FRAME_US / 4, "spread %" PRId64 " us", hi - lo);
+	close(sock);
+
+	return sim_done("test_group");
+}
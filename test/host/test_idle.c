@@ -0,0 +1,57 @@
+/* *********************************************************
+ * power states of LEDC, built with and without
+ * LED_IDLE_POWER_SAVE (both with PM_ENABLE):
+ *	- without power save no power management lock is taken
+ *	  and LEDC keeps running
+ *	- with power save both locks are held only while the light
+ *	  is active, LEDC stops only after the fade out finished
+ ************************************************************/
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+#ifdef CONFIG_LED_IDLE_POWER_SAVE
+#define LOCKS_ON	2
+#else
+#define LOCKS_ON	0
+#endif
+
+int main(void){
+	uint64_t active_ms, idle_ms;
+
+	sim_init(true);
+	init_led_2_channels();
+	sim_advance(100000);
+
+	CHECK(sim_pm_held() == 0, "%d locks held after start", sim_pm_held());
+	CHECK(sim_put("fade-time", "500") >= 0, "fade time rejected");
+	sim_advance(100000);
+
+	for (int i = 0; i < 5; i++){
+		CHECK(sim_put("on", "true") == 1, "ON rejected");
+		sim_advance(100000);
+		CHECK(sim_pm_held() == LOCKS_ON, "%d locks held while ON", sim_pm_held());
+		CHECK(sim_ledc_idle() == false, "LEDC stopped while ON");
+		sim_advance(2000000);
+
+		CHECK(sim_put("on", "false") == 1, "OFF rejected");
+		sim_advance(250000);
+		CHECK(sim_pm_held() == LOCKS_ON, "%d locks held during fade out", sim_pm_held());
+		CHECK(sim_ledc_output(0) + sim_ledc_output(1) > 0, "dark during fade out");
+		sim_advance(2000000);
+		CHECK(sim_ledc_output(0) + sim_ledc_output(1) == 0, "light after fade out");
+		CHECK(sim_pm_held() == 0, "%d locks held while OFF", sim_pm_held());
+#ifdef CONFIG_LED_IDLE_POWER_SAVE
+		CHECK(sim_ledc_idle() == true, "LEDC running while OFF");
+#else
+		CHECK(sim_ledc_idle() == false, "LEDC stopped without power save");
+#endif
+	}
+	CHECK(sim_ledc.glitches == 0, "%u outputs cut while lit", sim_ledc.glitches);
+	CHECK(sim_ledc.dark_fades == 0, "%u fades on stopped timer", sim_ledc.dark_fades);
+
+	get_led_power_stats(&active_ms, &idle_ms);
+	CHECK(active_ms >= 5 * 2300, "active %" PRIu64 " ms", active_ms);
+	CHECK(idle_ms >= 5 * 1600, "idle %" PRIu64 " ms", idle_ms);
+
+	return sim_done("test_idle");
+}
@@ -0,0 +1,55 @@
+/* *********************************************************
+ * level-a/level-b properties and the notifier task, with
+ * subscribers taking 50 ms per message:
+ *	- levels are integer percents, streamed during the fade
+ *	  and final after it
+ *	- the LED task never sends a message itself, apply and
+ *	  timer actions are completed by the notifier task
+ ************************************************************/
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+int main(void){
+	uint32_t level_msgs;
+	int a;
+
+	sim_init(false);
+	init_led_2_channels();
+	sim_sleep_ms(200);
+
+	CHECK(sim_put("channel", "A") >= 0, "channel rejected");
+	CHECK(sim_put("brightness", "100") >= 0, "brightness rejected");
+	CHECK(sim_put("fade-time", "1000") >= 0, "fade time rejected");
+	sim_sleep_ms(200);
+	sim_notify_delay(50000);
+
+	level_msgs = sim_notified("level-a");
+	CHECK(sim_put("on", "true") == 1, "ON rejected");
+	sim_sleep_ms(500);
+	a = sim_prop_int("level-a");
+	CHECK((a > 10) && (a < 90), "level A %d in the middle of the fade", a);
+	sim_sleep_ms(1000);
+	CHECK(sim_prop_int("level-a") == 100, "level A %d after fade", sim_prop_int("level-a"));
+	CHECK(sim_prop_int("level-b") == 0, "level B %d", sim_prop_int("level-b"));
+	level_msgs = sim_notified("level-a") - level_msgs;
+	CHECK(level_msgs >= 3, "level sent %u times during the fade", level_msgs);
+	CHECK(level_msgs <= CONFIG_LED_LEVEL_RATE_HZ + 2, "level sent %u times, rate not limited",
+			level_msgs);
+
+	//duration is in minutes, the timer is shortened after start
+	CHECK(sim_run("timer", "{\"duration\":1}") >= 0, "timer rejected");
+	xTimerChangePeriod(timer, pdMS_TO_TICKS(200), 0);
+	sim_sleep_ms(1500);
+	CHECK(sim_completed("timer") == 1, "timer not completed");
+	CHECK(sim_prop_int("on") == 0, "ON after timer");
+	CHECK(sim_prop_int("level-a") == 0, "level A %d after timer", sim_prop_int("level-a"));
+
+	CHECK(sim_run("apply", "{\"on\":true,\"fade-time\":300}") >= 0, "apply rejected");
+	sim_sleep_ms(1000);
+	CHECK(sim_completed("apply") == 1, "apply not completed");
+
+	CHECK(sim_server.from_led_task == 0, "%u messages sent by the LED task",
+			sim_server.from_led_task);
+
+	return sim_done("test_level");
+}
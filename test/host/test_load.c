@@ -0,0 +1,131 @@
+/* *********************************************************
+ * load manager, two 50 W channels on a 60 W power supply:
+ *	- combined load of both outputs sampled every millisecond
+ *	  never exceeds the budget, the peak of every 100 ms is
+ *	  printed for each step
+ *	- load rises not faster than the full budget in
+ *	  LOAD_RAMP_MS, also when a rising fade is replaced
+ *	- requested brightness is limited to the budget of the
+ *	  channel mode and subscribers get the limited value
+ *	- brightness saved in NVS with a larger budget is limited
+ *	  at start and when the timer restores NVS data
+ ************************************************************/
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+#define SAMPLES_MAX		2000
+#define RISE_MS			10		//window of the slew rate check
+//the highest load rise in RISE_MS, 2 % for integer fade steps
+#define RISE_MAX		((uint64_t)LOAD_BUDGET * RISE_MS * 102 / 100 / LOAD_RAMP_MS)
+
+static uint32_t samples[SAMPLES_MAX];
+
+static uint32_t load_now(void){
+	return sim_ledc_output(LEDC_CHANNEL_A) * LOAD_W_A +
+			sim_ledc_output(LEDC_CHANNEL_B) * LOAD_W_B;
+}
+
+//sample load for ms milliseconds, check budget and slew rate
+static void run(const char *step, int ms){
+	uint32_t peak, rise_max = 0;
+
+	for (int i = 0; i < ms; i++){
+		sim_advance(1000);
+		samples[i] = load_now();
+		CHECK(samples[i] <= LOAD_BUDGET, "%s: %u ms: load %u%% of budget", step, i,
+				(uint32_t)((uint64_t)samples[i] * 100 / LOAD_BUDGET));
+		if ((i >= RISE_MS) && (samples[i] > samples[i - RISE_MS]) &&
+			(samples[i] - samples[i - RISE_MS] > rise_max)){
+			rise_max = samples[i] - samples[i - RISE_MS];
+		}
+	}
+	CHECK(rise_max <= RISE_MAX, "%s: load rise %u in %d ms, max %u", step, rise_max,
+			RISE_MS, (uint32_t)RISE_MAX);
+
+	printf("%-12s peak load [%% of budget] every 100 ms:", step);
+	for (int i = 0; i < ms; i += 100){
+		peak = 0;
+		for (int j = i; (j < i + 100) && (j < ms); j++){
+			peak = (samples[j] > peak) ? samples[j] : peak;
+		}
+		printf(" %u", (uint32_t)((uint64_t)peak * 100 / LOAD_BUDGET));
+	}
+	printf("\n");
+}
+
+//as wall switch or group command, replaces running fade
+static int16_t force_brightness(void *arg){
+	light_req_t req = {.mask = LIGHT_BRGH, .brightness = *(int32_t *)arg};
+
+	return light_force(&req);
+}
+
+int main(void){
+	uint32_t sent, peak_mw, limited;
+	int32_t brgh = 50;
+	nvs_handle nvs;
+
+	sim_init(true);
+	//saved with a 100 W supply
+	nvs_open("storage", NVS_READWRITE, &nvs);
+	nvs_set_i8(nvs, "curr_channel", CH_AB);
+	nvs_set_i32(nvs, "brightness", 100);
+	nvs_set_i32(nvs, "fade_time", 100);
+	nvs_commit(nvs);
+	nvs_close(nvs);
+	init_led_2_channels();
+	sim_advance(6000000);
+	CHECK(sim_prop_int("brightness") == 60, "brightness %d from NVS",
+			sim_prop_int("brightness"));
+
+	//the timer switches ON, at the end NVS data are restored
+	CHECK(sim_run("timer", "{\"duration\":1}") == 0, "timer rejected");
+	run("timer ON", 1000);
+	sim_advance(60000000);
+	CHECK(sim_prop_int("on") == 0, "ON after timer");
+	CHECK(sim_prop_int("brightness") == 60, "brightness %d restored by timer",
+			sim_prop_int("brightness"));
+	get_led_load_stats(&peak_mw, &limited);
+	sim_put("on", "true");
+	run("after timer", 1000);
+	get_led_load_stats(&peak_mw, &sent);
+	CHECK(sent == limited, "output scaled after timer");
+	sim_put("on", "false");
+	run("OFF", 200);
+
+	//one channel fits the budget, inrush ramp is extended
+	sim_put("channel", "A");
+	sim_put("brightness", "100");
+	sim_put("on", "true");
+	run("A 100%", 1000);
+	CHECK(sim_prop_int("brightness") == 100, "brightness %d", sim_prop_int("brightness"));
+
+	//both channels, brightness is limited
+	sent = sim_notified("brightness");
+	CHECK(sim_put("channel", "A+B") == 1, "channel rejected");
+	CHECK(sim_prop_int("brightness") == 60, "brightness %d in A+B mode",
+			sim_prop_int("brightness"));
+	run("A+B", 1000);
+	CHECK(sim_notified("brightness") > sent, "limited brightness not sent");
+	sim_put("brightness", "100");
+	CHECK(sim_prop_int("brightness") == 60, "brightness %d accepted over budget",
+			sim_prop_int("brightness"));
+	run("A+B 100%", 500);
+
+	//rising fade replaced after 50 ms, the new fade starts from the
+	//present output, not from the target of the replaced one
+	sim_put("on", "false");
+	run("OFF", 1000);
+	sim_put("on", "true");
+	run("ON", 50);
+	CHECK(sim_call(force_brightness, &brgh) > 0, "brightness not changed");
+	run("replaced", 1000);
+	CHECK(load_now() == (uint32_t)(LEDC_MAX_DUTY * 50 / 100) * (LOAD_W_A + LOAD_W_B),
+			"final load %u", load_now());
+
+	get_led_load_stats(&peak_mw, &limited);
+	printf("peak load %u mW, %u transitions limited\n", peak_mw, limited);
+	CHECK(peak_mw <= CONFIG_LED_LOAD_PSU_WATTS * 1000, "peak load %u mW", peak_mw);
+
+	return sim_done("test_load");
+}
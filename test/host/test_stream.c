@@ -0,0 +1,112 @@
+/* *********************************************************
+ * streaming mode over loopback UDP, sender at 50 Hz with
+ * +-8 ms jitter:
+ *	- frames are played at the stream rate with small jitter,
+ *	  none is lost or late
+ *	- property changes are rejected and no message is sent to
+ *	  subscribers while streaming, all properties are sent
+ *	  again after the stream timeout
+ ************************************************************/
+#include <unistd.h>
+
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+#define FRAMES		150
+#define PERIOD_US	(1000000 / CONFIG_LED_STREAM_RATE_HZ)
+#define JITTER_US	8000
+
+static int64_t updates[FRAMES * 2];
+static int updates_number = 0;
+
+//time of every new duty of channel A written by the stream timer
+static void ledc_hook(int ch, uint32_t from, uint32_t to, int32_t ms){
+	if ((ch == LEDC_CHANNEL_A) && (ms == 0) && (from != to) &&
+		(updates_number < FRAMES * 2)){
+		updates[updates_number++] = sim_real_us();
+	}
+}
+
+static int cmp_i64(const void *a, const void *b){
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(void){
+	struct sockaddr_in dst = {.sin_family = AF_INET};
+	stream_frame_t frame = {.magic = STREAM_MAGIC};
+	unsigned seed = 35;
+	int sock, n;
+	int64_t start, send_at, iv[FRAMES * 2];
+	uint32_t notifications, brgh_sent;
+
+	sim_init(false);
+	sim_port_offset(20000 + getpid() % 20000);
+	init_led_2_channels();
+	sim_sleep_ms(300);
+	sim_ledc_hook = ledc_hook;
+
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	dst.sin_port = htons(sim_port(CONFIG_LED_STREAM_PORT));
+	dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	notifications = sim_server.notifications;
+	brgh_sent = sim_notified("brightness");
+	start = sim_real_us();
+	for (int i = 0; i < FRAMES; i++){
+		send_at = start + (int64_t)i * PERIOD_US + rand_r(&seed) % (2 * JITTER_US) - JITTER_US;
+		if (send_at > sim_real_us()){
+			usleep(send_at - sim_real_us());
+		}
+		frame.seq = 1000 + i;
+		frame.timestamp = i * (PERIOD_US / 1000);
+		frame.duty[0] = 100 + i * 10;
+		frame.duty[1] = LEDC_MAX_DUTY - i * 10;
+		sendto(sock, &frame, sizeof(frame), 0, (struct sockaddr *)&dst, sizeof(dst));
+		if (i == FRAMES / 2){
+			CHECK(stream_active == true, "stream not active");
+			CHECK(sim_put("brightness", "30") < 0, "property changed while streaming");
+		}
+	}
+	sim_sleep_ms(100);
+	CHECK(sim_server.notifications == notifications, "%u messages sent while streaming",
+			sim_server.notifications - notifications);
+	sim_sleep_ms(CONFIG_LED_STREAM_TIMEOUT + 500);
+	CHECK(stream_active == false, "stream not stopped after timeout");
+	CHECK(sim_notified("brightness") > brgh_sent, "properties not sent after stream");
+	close(sock);
+
+	//every frame played once at the stream rate
+	CHECK(stream_stats.received == FRAMES, "%u frames received", stream_stats.received);
+	CHECK(stream_stats.played == FRAMES, "%u frames played", stream_stats.played);
+	CHECK(stream_stats.lost + stream_stats.late == 0, "%u lost, %u late",
+			stream_stats.lost, stream_stats.late);
+	CHECK(updates_number == FRAMES, "%d duty updates", updates_number);
+	n = updates_number - 1;
+	if (n > 10){
+		double rate = 1e6 * n / (updates[n] - updates[0]);
+		int64_t dev = 0;
+
+		for (int i = 0; i < n; i++){
+			iv[i] = updates[i + 1] - updates[i];
+			dev += llabs(iv[i] - PERIOD_US);
+		}
+		dev /= n;
+		qsort(iv, n, sizeof(int64_t), cmp_i64);
+		printf("played %.2f frames/s, interval p10 %" PRId64 " p50 %" PRId64 " p90 %" PRId64
+				" us, mean deviation %" PRId64 " us, arrival jitter %" PRId64 " us\n", rate,
+				iv[n / 10], iv[n / 2], iv[n * 9 / 10], dev, stream_stats.jitter / 16);
+		CHECK((rate > CONFIG_LED_STREAM_RATE_HZ * 0.97) && (rate < CONFIG_LED_STREAM_RATE_HZ * 1.03),
+				"rate %.2f frames/s", rate);
+		//sender jitter (mean deviation of intervals about 5 ms) is absorbed
+		//by the jitter buffer, the rest is host scheduling
+		CHECK(dev < 2000, "played interval mean deviation %" PRId64 " us", dev);
+		CHECK((iv[n / 10] > PERIOD_US - 3000) && (iv[n * 9 / 10] < PERIOD_US + 3000),
+				"played interval p10 %" PRId64 " p90 %" PRId64 " us", iv[n / 10], iv[n * 9 / 10]);
+		CHECK(stream_stats.jitter / 16 > 1000, "arrival jitter %" PRId64 " us not measured",
+				stream_stats.jitter / 16);
+	}
+
+	return sim_done("test_stream");
+}
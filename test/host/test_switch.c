@@ -0,0 +1,70 @@
+/* *********************************************************
+ * wall switch latency with slow subscribers (50 ms per
+ * message): from the switch edge to the start of the LEDC
+ * fade stays in single milliseconds, the maximum measured
+ * by the component is shown in diagnostics
+ ************************************************************/
+#include "webthing_led_2_channels.c"
+#include "sim.h"
+
+#define CYCLES		20
+#define LIMIT_US	10000
+
+static volatile int64_t edge_at = 0, fade_at = 0;
+
+static void ledc_hook(int ch, uint32_t from, uint32_t to, int32_t ms){
+	if ((ms > 0) && (fade_at == 0)){
+		fade_at = sim_real_us();
+	}
+}
+
+//edge of the switch, output: time to the first fade [us]
+static int64_t edge(int level){
+	fade_at = 0;
+	edge_at = sim_real_us();
+	sim_gpio_set(CONFIG_LED_SWITCH_GPIO, level);
+	for (int i = 0; (i < 200) && (fade_at == 0); i++){
+		sim_sleep_ms(1);
+	}
+	return (fade_at == 0) ? INT64_MAX : fade_at - edge_at;
+}
+
+int main(void){
+	int64_t lat, max = 0;
+
+	sim_init(false);
+	init_led_2_channels();
+	CHECK(sim_put("fade-time", "200") >= 0, "fade time rejected");
+	sim_sleep_ms(300);
+	sim_notify_delay(50000);
+	sim_ledc_hook = ledc_hook;
+
+	for (int i = 0; i < CYCLES; i++){
+		//press while OFF, ON at once
+		lat = edge(1);
+		max = (lat > max) ? lat : max;
+		sim_sleep_ms(100);
+		sim_gpio_set(CONFIG_LED_SWITCH_GPIO, 0);
+		sim_sleep_ms(300);
+		//short press while ON, OFF on release
+		sim_gpio_set(CONFIG_LED_SWITCH_GPIO, 1);
+		sim_sleep_ms(100);
+		lat = edge(0);
+		max = (lat > max) ? lat : max;
+		sim_sleep_ms(300);
+	}
+	printf("switch edge to fade: max %" PRId64 " us, component max %" PRId64 " us\n",
+			max, switch_latency_max);
+	CHECK(max < LIMIT_US, "latency %" PRId64 " us", max);
+	CHECK(switch_latency_max < LIMIT_US, "component latency %" PRId64 " us",
+			switch_latency_max);
+	CHECK(sim_prop_int("on") == 0, "ON after last cycle");
+
+	sim_notify_delay(0);
+	diag_update();
+	sim_sleep_ms(100);
+	CHECK(strstr(sim_prop_str("diagnostics"), "switch max:") != NULL, "diagnostics: %s",
+			sim_prop_str("diagnostics"));
+
+	return sim_done("test_switch");
+}
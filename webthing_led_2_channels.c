@@ -18,118 +18,567 @@
 #include "freertos/task.h"
 #include "freertos/timers.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#if defined(CONFIG_LED_IDLE_POWER_SAVE) && defined(CONFIG_PM_ENABLE)
+#include "esp_pm.h"
+#endif
+#if defined(CONFIG_LED_STREAM_ENABLE) || defined(CONFIG_LED_BINARY_ENABLE)
+#include "lwip/sockets.h"
+#endif
 #include "driver/ledc.h"
+#ifdef CONFIG_LED_SWITCH_ENABLE
+#include "driver/gpio.h"
+#endif
 #include "nvs_flash.h"
 #include "esp_log.h"
 
 #include "simple_web_thing_server.h"
 #include "webthing_led_2_channels.h"
 
-typedef enum {CH_A = 0, CH_B = 1, CH_AB = 2} channel_t;
-typedef enum {CHANNEL = 0, BRIGHTNESS = 1, FADE = 2} nvs_data_type_t;
+typedef enum {CH_A = 0, CH_B = 1, CH_AB = 2, CH_CCT = 3, CH_NUMBER} channel_t;
+//data persisted in NVS, RAM shadow of the flash record
+#define NVS_CHANNEL		0x01
+#define NVS_BRIGHTNESS	0x02
+#define NVS_FADE		0x04
+#define NVS_COLOR_TEMP	0x08
+typedef struct {
+	channel_t channel;
+	int32_t brightness;
+	int32_t fade_time;
+	int32_t color_temp;
+} nvs_record_t;
 #define APP_PERIOD 5000
 
+//light properties changed in one step
+#define LIGHT_ON		0x01
+#define LIGHT_CHANNEL	0x02
+#define LIGHT_BRGH		0x04
+#define LIGHT_FADE		0x08
+#define LIGHT_CCT		0x10
+typedef struct {
+	uint8_t mask;		//properties to be set, LIGHT_xxx
+	bool on;
+	channel_t channel;
+	int32_t brightness;
+	int32_t fade_time;
+	int32_t color_temp;
+} light_req_t;
+
+//events handled by the LED task
+#define LED_EV_WAKE			0x02	//LEDC is active again, resume periodic work
+#define LED_EV_FADE			0x04	//fade started, stream current level
+#define LED_EV_GROUP		0x08	//start time of group transition reached
+#define LED_EV_SW_PRESS		0x10	//wall switch pressed
+#define LED_EV_SW_RELEASE	0x20	//wall switch released
+#define LED_EV_SW_TOGGLE	0x40	//rocker switch changed position
+
+//messages sent by the notifier task, low bits are LIGHT_xxx changes
+#define NTF_LIGHT			0x001f
+#define NTF_LEVEL			0x0100	//real level of channels
+#define NTF_DAILY_ON		0x0200	//daily ON time
+#define NTF_DIAG			0x0400	//diagnostics
+#define NTF_INIT			0x0800	//all properties, after start and stream
+#define NTF_APPLY_DONE		0x1000	//apply action completed
+#define NTF_TIMER_DONE		0x2000	//timer action completed
+
 //relays
 #define GPIO_CH_A			(CONFIG_CHANNEL_A_GPIO)
 #define GPIO_CH_B			(CONFIG_CHANNEL_B_GPIO)
 #define LEDC_CHANNEL_A		LEDC_CHANNEL_0
 #define LEDC_CHANNEL_B		LEDC_CHANNEL_1
+#define LEDC_MAX_DUTY		8191	//13 bit resolution
+
+//tunable white, channel A - warm white, channel B - cool white
+#define CCT_WARM			(CONFIG_LED_CCT_WARM_K)
+#define CCT_COOL			(CONFIG_LED_CCT_COOL_K)
+#define CCT_STEP			50		//kelvins between mixing table entries
+#define CCT_TAB_LEN			((CCT_COOL - CCT_WARM) / CCT_STEP + 2)
+#define CCT_FRAC_BITS		12		//fixed point fraction of cool channel
+#if CCT_COOL <= CCT_WARM
+#error "LED_CCT_COOL_K must be greater than LED_CCT_WARM_K"
+#endif
 
 #define ESP_INTR_FLAG_DEFAULT 0
 
+#define LED_TASK_STACK		(CONFIG_LED_TASK_STACK_SIZE)
+#define LED_TASK_PRIORITY	(CONFIG_LED_TASK_PRIORITY)
+#define NOTIFY_TASK_STACK	3072
+#ifdef CONFIG_LED_DIAGNOSTICS
+#define PROP_NUMBER			9	//number of properties
+#else
+#define PROP_NUMBER			8	//number of properties
+#endif
+#define ACTION_NUMBER		2	//number of actions
+
 xSemaphoreHandle led_mux;
 xTaskHandle led_task;
+xTaskHandle notify_task;	//sends messages to subscribers for the LED task
+
+#ifdef CONFIG_LED_DIAGNOSTICS
+//------  property "diagnostics", read only, stack and timing headroom
+typedef struct {
+	uint32_t last;			//us
+	uint32_t max;			//us
+} diag_time_t;
+
+static diag_time_t diag_fade_cb, diag_timer_cb;	//timer service callbacks
+static diag_time_t diag_mux;					//led_mux hold time
+static int64_t diag_mux_taken = 0;
+static char diagnostics[200] = "";
+property_t *prop_diag;
+static const char diag_id[] = "diagnostics";
+static const char diag_prop_disc[] = "Free stack of tasks [B], callback and mutex hold times [us]";
+static const char diag_prop_title[] = "Diagnostics";
+void diag_update(void);
+
+static inline void diag_time_add(diag_time_t *d, int64_t start){
+	d -> last = esp_timer_get_time() - start;
+	if (d -> last > d -> max){
+		d -> max = d -> last;
+	}
+}
+#endif
+
+//led_mux with hold time measurement
+static inline void led_lock(void){
+	xSemaphoreTake(led_mux, portMAX_DELAY);
+#ifdef CONFIG_LED_DIAGNOSTICS
+	diag_mux_taken = esp_timer_get_time();
+#endif
+}
+
+static inline void led_unlock(void){
+#ifdef CONFIG_LED_DIAGNOSTICS
+	diag_time_add(&diag_mux, diag_mux_taken);
+#endif
+	xSemaphoreGive(led_mux);
+}
+
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+//all objects are reserved at compile time, no heap is used
+static StaticSemaphore_t led_mux_buff;
+static StaticTask_t led_task_buff;
+static StackType_t led_task_stack[LED_TASK_STACK];
+static StaticTask_t notify_task_buff;
+static StackType_t notify_task_stack[NOTIFY_TASK_STACK];
+static StaticTimer_t fade_timer_buff, timer_buff;
+static thing_t leds_buff;
+static property_t prop_buff[PROP_NUMBER];
+static action_t action_buff[ACTION_NUMBER];
+static int prop_buff_used = 0, action_buff_used = 0;
+#endif
 
 static bool DRAM_ATTR fade_is_running = false;
 //static int32_t DRAM_ATTR fade_counter = 0;
 static bool init_data_sent = false;
 static bool timer_is_running = false;
+static bool apply_is_running = false;
 static channel_t current_channel, prev_current_channel;
+static uint32_t channel_duty[2] = {0, 0}; //duty channels are fading to
+static int64_t fade_end[2] = {0, 0};	//end of the last fade of channels [us]
+static int64_t transition_start = 0;	//the first fade of the last transition [us]
 
 //THINGS AND PROPERTIES
 //------------------------------------------------------------
+//descriptor strings and tables are const and stay in flash,
+//init_led_2_channels() walks the tables
 //--- Thing
 thing_t *leds = NULL;
-
-char leds_id_str[] = "2 leds";
-char leds_attype_str[] = "Light";
-char leds_disc[] = "Dimmable leds, 2 channels";
 at_type_t leds_type;
+static const char leds_id_str[] = "2 leds";
+static const char leds_attype_str[] = "Light";
+static const char leds_disc[] = "Dimmable leds, 2 channels";
 
 //------  property "on" - ON/OFF state
 static bool device_is_on = false;
 property_t *prop_on;
-at_type_t on_prop_type;
 int16_t set_on_off(char *name, char *new_value_str); //switch ON/OFF
-char on_prop_id[] = "on";
-char on_prop_disc[] = "on-off state";
-char on_prop_attype_str[] = "OnOffProperty";
-char on_prop_title[] = "ON/OFF";
+static const char on_prop_id[] = "on";
+static const char on_prop_disc[] = "ON/OFF";
+static const char on_prop_attype_str[] = "OnOffProperty";
+static const char on_prop_title[] = "ON/OFF";
 
-//------  property "channel" - list of channels: A, B or AB
+//------  property "channel" - list of channels: A, B, AB or CCT
 property_t *prop_channel;
-at_type_t channel_prop_type;
-enum_item_t enum_ch_A, enum_ch_B, enum_ch_AB;
+enum_item_t channel_enum[CH_NUMBER];
 int16_t set_channel(char *name, char *new_value_str);
-char channel_prop_id[] = "channel";
-char channel_prop_disc[] = "Channel";
-char channel_prop_attype_str[] = "ChannelProperty";
-char channel_prop_title[] = "Channel";
-char channel_tab[3][4] = {"A", "B", "A+B"}; 
+static const char channel_prop_id[] = "channel";
+static const char channel_prop_disc[] = "Channel";
+static const char channel_prop_attype_str[] = "ChannelProperty";
+static const char channel_prop_title[] = "Channel";
+static const char channel_tab[CH_NUMBER][4] = {"A", "B", "A+B", "CCT"}; 
 
 //------  property "daily_on" - daily on time
 property_t *prop_daily_on_time;
-at_type_t daily_on_prop_type;
-static int daily_on_time_min = 0, daily_on_time_sec = 0;
-static time_t on_time_last_update = 0;
+static int daily_on_time_min = 0;
+static int64_t on_time_us = 0;		//ON time in the current day
+static int64_t on_time_mono = 0;	//last accumulation, monotonic [us]
+static int64_t day_end_mono = 0;	//next midnight, monotonic [us], 0 - unknown
+static time_t day_end_wall = 0;		//next midnight, wall clock
+#define DAY_END_MAX_STEP	2		//[s], larger wall clock step moves midnight
+#define DAY_END_RECHECK		60		//[s], wall clock steps are noticed within it
 void update_on_time(bool);
-char daily_on_prop_id[] = "daily-on";
-char daily_on_prop_disc[] = "amount of time device is ON";
-char daily_on_prop_attype_str[] = "LevelProperty";
-char daily_on_prop_unit[] = "min";
-char daily_on_prop_title[] = "ON minutes";
+void on_time_accumulate(int64_t now);
+TickType_t on_time_wait(void);
+static const char daily_on_prop_id[] = "daily-on";
+static const char daily_on_prop_disc[] = "amount of time device is ON";
+static const char daily_on_prop_attype_str[] = "LevelProperty";
+static const char daily_on_prop_unit[] = "min";
+static const char daily_on_prop_title[] = "ON minutes";
 
 //------  property "brightness"
 static TimerHandle_t fade_timer = NULL;
 void fade_timer_fun(TimerHandle_t xTimer);
 static int32_t brightness; //0..100 in percent
 property_t *prop_brgh;
-at_type_t brgh_prop_type;
-char brgh_id[] = "brightness";
-char brgh_prop_disc[] = "Led brightness";
-char brgh_prop_attype_str[] = "BrightnessProperty";
-char brgh_prop_unit[] = "percent";
-char brgh_prop_title[] = "Brightness";
+static const char brgh_id[] = "brightness";
+static const char brgh_prop_disc[] = "Led brightness";
+static const char brgh_prop_attype_str[] = "BrightnessProperty";
+static const char brgh_prop_unit[] = "percent";
+static const char brgh_prop_title[] = "Brightness";
+
+//------  property "color_temp", used in CCT channel mode
+static int32_t color_temp; //CCT_WARM .. CCT_COOL in kelvins
+static uint16_t cct_tab[CCT_TAB_LEN]; //fraction of cool channel for every CCT_STEP
+property_t *prop_color_temp;
+static const char color_temp_id[] = "color-temperature";
+static const char color_temp_prop_disc[] = "Color temperature in CCT mode";
+static const char color_temp_prop_attype_str[] = "ColorTemperatureProperty";
+static const char color_temp_prop_unit[] = "kelvin";
+static const char color_temp_prop_title[] = "Color temperature";
+
+//------  properties "level_a" and "level_b", read only, real level during fades
+static int32_t level_a = 0, level_b = 0; //0..100 in percent
+property_t *prop_level_a, *prop_level_b;
+static const char level_a_id[] = "level-a";
+static const char level_b_id[] = "level-b";
+static const char level_a_prop_disc[] = "Real level of channel A";
+static const char level_b_prop_disc[] = "Real level of channel B";
+static const char level_a_prop_title[] = "Level A";
+static const char level_b_prop_title[] = "Level B";
+static const char level_prop_attype_str[] = "LevelProperty";
+void level_update(void);
 
 //------  property "fade_time"
 static int32_t fade_time; //10..10000 ms
 property_t *prop_fade_time;
-at_type_t fade_time_prop_type;
-char fade_time_id[] = "fade-time";
-char fade_time_prop_disc[] = "Fade time in ms";
-char fade_time_prop_attype_str[] = "LevelProperty";
-char fade_time_prop_unit[] = "ms";
-char fade_time_prop_title[] = "Fade time";
+static const char fade_time_id[] = "fade-time";
+static const char fade_time_prop_disc[] = "Fade time in ms";
+static const char fade_time_prop_attype_str[] = "LevelProperty";
+static const char fade_time_prop_unit[] = "ms";
+static const char fade_time_prop_title[] = "Fade time";
 
 //------ action "timer"
 static TimerHandle_t timer = NULL;
 action_t *timer_action;
 int16_t timer_run(char *inputs);
-char timer_id[] = "timer";
-char timer_title[] = "Timer";
-char timer_desc[] = "Turn ON device for specified period of time";
-char timer_input_attype_str[] = "ToggleAction";
-char timer_prop_dur_id[] = "duration";
-action_input_prop_t *timer_duration;
-//char timer_duration_unit[] = "min";
-at_type_t timer_input_attype;
+static const char timer_id[] = "timer";
+static const char timer_title[] = "Timer";
+static const char timer_desc[] = "Turn ON device for specified period of time";
+static const char timer_input_attype_str[] = "ToggleAction";
+static const char timer_prop_dur_id[] = "duration";
+static const char timer_duration_unit[] = "minutes";
+
+//------ action "apply"
+action_t *apply_action;
+int16_t apply_run(char *inputs);
+static const char apply_id[] = "apply";
+static const char apply_title[] = "Apply";
+static const char apply_desc[] = "Set several properties with one transition";
+
+//------ descriptors of properties and actions
+typedef struct {
+	property_t **prop;		//property created from the descriptor
+	const char *id;
+	const char *title;
+	const char *description;
+	const char *at_type;	//NULL - no @type
+	const char *unit;		//NULL - no unit
+	int8_t type;			//VAL_BOOLEAN, VAL_INTEGER, ...
+	void *value;
+	bool read_only;
+	bool has_range;
+	int32_t min, max;
+	int16_t (*set)(char *, char *);
+} prop_desc_t;
+
+typedef struct {
+	const char *id;
+	int8_t type;
+	bool required;
+	bool has_range;
+	int32_t min, max;
+	const char *unit;		//NULL - no unit
+	bool channel_enum;		//value is one of the channels
+} input_desc_t;
+
+typedef struct {
+	action_t **action;		//action created from the descriptor
+	const char *id;
+	const char *title;
+	const char *description;
+	const char *input_at_type;	//NULL - no @type
+	int16_t (*run)(char *);
+	const input_desc_t *inputs;
+	int inputs_number;
+} action_desc_t;
+
+at_type_t prop_types[PROP_NUMBER];
+at_type_t action_types[ACTION_NUMBER];
 
 //task function
 void leds_fun(void *param); //thread function
 
+//light state
+void light_transition(void);
+void light_duty(int32_t brgh, uint32_t *duty_a, uint32_t *duty_b);
+uint8_t light_update(const light_req_t *req);
+int16_t light_apply(const light_req_t *req);
+int16_t light_force(const light_req_t *req);
+
+//low power idle, LEDC is stopped when both channels are dark
+static bool ledc_is_idle = false;
+static int64_t power_state_since = 0;	//us
+static int64_t active_time = 0, idle_time = 0; //us, total time in each state
+#if defined(CONFIG_LED_IDLE_POWER_SAVE) && defined(CONFIG_PM_ENABLE)
+//held only while LEDC is active, without power save no lock is taken
+static esp_pm_lock_handle_t pm_apb_lock = NULL, pm_sleep_lock = NULL;
+#endif
+void ledc_idle_enter(void);
+void ledc_idle_exit(void);
+
+#ifdef CONFIG_LED_LOAD_MANAGER
+//power supply budget, load is counted in duty x watts
+#define LOAD_W_A			(CONFIG_LED_LOAD_A_WATTS)
+#define LOAD_W_B			(CONFIG_LED_LOAD_B_WATTS)
+#define LOAD_BUDGET			((uint32_t)CONFIG_LED_LOAD_PSU_WATTS * LEDC_MAX_DUTY)
+#define LOAD_RAMP_MS		(CONFIG_LED_LOAD_RAMP_MS)	//the shortest ramp of full budget
+static uint32_t load_peak = 0;		//the highest combined load
+static uint32_t load_limited = 0;	//number of limited transitions and frames
+static bool load_scale(uint32_t *duty_a, uint32_t *duty_b);
+static int32_t load_limit(uint32_t *duty_a, uint32_t *duty_b, int32_t ft);
+#endif
+
+//streaming mode, frames from external sequencer are applied directly
+//to LEDC, property changes are rejected and notifications suppressed
+static bool stream_active = false;
+#ifdef CONFIG_LED_STREAM_ENABLE
+#define STREAM_MAGIC		0x4C53	//"LS"
+#define STREAM_BUF_LEN		8		//jitter buffer slots
+#define STREAM_TASK_STACK	3072
+typedef struct __attribute__((packed)) {
+	uint16_t magic;
+	uint16_t seq;			//frame sequence number
+	uint32_t timestamp;		//sender time [ms]
+	uint16_t duty[2];		//channel A and B, 0 .. LEDC_MAX_DUTY
+} stream_frame_t;			//little endian
+
+typedef struct {
+	uint16_t duty[2];
+	bool valid;
+} stream_slot_t;
+
+static stream_slot_t stream_buf[STREAM_BUF_LEN];
+static uint16_t stream_next_seq;	//next frame to be played
+static int stream_buffered = 0;		//frames in jitter buffer
+static bool stream_prefill = true;	//wait for LED_STREAM_DEPTH frames
+static uint32_t stream_duty[2];		//last played frame
+static int64_t stream_last_rx = 0;	//us
+static int64_t stream_transit_prev = 0;
+static esp_timer_handle_t stream_tick = NULL;
+static portMUX_TYPE stream_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct {
+	uint32_t received, played, late, lost, underruns;
+	int64_t jitter;		//interarrival jitter x16 [us]
+} stream_stats;
+xTaskHandle stream_task;
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+static StaticTask_t stream_task_buff;
+static StackType_t stream_task_stack[STREAM_TASK_STACK];
+#endif
+void stream_fun(void *param);
+void stream_tick_fun(void *arg);
+#endif
+
+#ifdef CONFIG_LED_BINARY_ENABLE
+//binary control over UDP, little endian records
+#define BIN_MAGIC			0x4C43	//"LC"
+#define BIN_CLIENTS			4		//clients remembered for retransmissions
+#define BIN_TASK_STACK		3072
+typedef enum {
+	BIN_OP_GET = 0,			//only read state
+	BIN_OP_ON = 1,			//value: 0 - OFF, 1 - ON
+	BIN_OP_BRIGHTNESS = 2,	//value: 0 .. 100
+	BIN_OP_CHANNEL = 3,		//value: channel_t
+	BIN_OP_FADE = 4,		//value: 100 .. 10000 ms
+	BIN_OP_TIMER = 5,		//value: 1 .. 600 minutes
+	BIN_OP_CCT = 6,			//value: color temperature in kelvins
+	BIN_OP_SYNC = 7,		//bin_time_t, clock sync request
+	BIN_OP_SYNC_RESULT = 8,	//bin_time_t, clock sync result
+	BIN_OP_GROUP = 9		//bin_group_t, transition of device group
+} bin_op_t;
+
+typedef struct __attribute__((packed)) {
+	uint16_t magic;
+	uint8_t op;				//bin_op_t
+	uint8_t reserved;
+	uint16_t seq;			//sequence number
+	int32_t value;
+} bin_req_t;
+
+typedef struct __attribute__((packed)) {
+	uint16_t magic;
+	uint8_t op;
+	int8_t status;			//0 - not changed, 1 - changed, -1 - error
+	uint16_t seq;
+	uint8_t on;				//current state
+	uint8_t channel;
+	uint8_t brightness;
+	uint8_t reserved;
+	uint16_t fade_time;
+	uint16_t color_temp;
+} bin_resp_t;
+
+typedef struct {
+	uint32_t addr;			//IPv4 address, network order
+	uint16_t port;			//network order
+	bin_resp_t resp;		//last response
+} bin_client_t;
+
+static bin_client_t bin_clients[BIN_CLIENTS];
+xTaskHandle bin_task;
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+static StaticTask_t bin_task_buff;
+static StackType_t bin_task_stack[BIN_TASK_STACK];
+#endif
+void bin_fun(void *param);
+
+#ifdef CONFIG_LED_GROUP_SYNC
+//group transitions start at the same instant on all devices, clock
+//offset to the gateway is estimated from NTP like exchanges:
+//	gateway -> SYNC (t1), device -> SYNC (t2, t3),
+//	gateway -> SYNC_RESULT (t1, t4)
+#define GROUP_ALL			0		//group ID of all devices
+#define SYNC_SAMPLES		8		//offset samples, the best one is used
+
+typedef struct __attribute__((packed)) {
+	uint16_t magic;
+	uint8_t op;				//BIN_OP_SYNC, BIN_OP_SYNC_RESULT
+	uint8_t reserved;
+	uint16_t seq;			//sync exchange number
+	int64_t t_a;			//t1 from gateway, t2 from device [us]
+	int64_t t_b;			//t4 from gateway, t3 from device [us]
+} bin_time_t;
+
+typedef struct __attribute__((packed)) {
+	uint16_t magic;
+	uint8_t op;				//BIN_OP_GROUP
+	uint8_t group;			//group ID, GROUP_ALL for all devices
+	uint16_t seq;
+	int64_t start;			//start time, gateway clock [us]
+	uint8_t mask;			//LIGHT_xxx values used
+	uint8_t on;
+	uint8_t channel;
+	uint8_t brightness;
+	uint16_t fade_time;
+	uint16_t color_temp;
+} bin_group_t;
+
+typedef struct {
+	uint16_t seq;
+	int64_t t2, t3;			//device receive and send time [us]
+} sync_pending_t;
+
+typedef struct {
+	int64_t offset;			//device - gateway clock [us]
+	int64_t delay;			//round trip without device time [us]
+} sync_sample_t;
+
+static sync_pending_t sync_pending[SYNC_SAMPLES];
+static sync_sample_t sync_samples[SYNC_SAMPLES];
+static uint8_t sync_sample_idx = 0;
+static int64_t sync_offset = 0;
+static bool sync_valid = false;
+static light_req_t group_req;		//scheduled transition, under led_mux
+static esp_timer_handle_t group_timer;
+
+void sync_result(const bin_time_t *res);
+int8_t group_schedule(const bin_group_t *cmd);
+void group_timer_fun(void *arg);
+void group_apply(void);
+#endif
+#endif
+
+#ifdef CONFIG_LED_SWITCH_ENABLE
+//local wall switch, edges are debounced in ISR and handled in LED task
+#define SWITCH_GPIO			(CONFIG_LED_SWITCH_GPIO)
+#ifdef CONFIG_LED_SWITCH_ACTIVE_LOW
+#define SWITCH_ACTIVE		0		//input level when pressed
+#else
+#define SWITCH_ACTIVE		1
+#endif
+#define SWITCH_DEBOUNCE_US	((int64_t)CONFIG_LED_SWITCH_DEBOUNCE_MS * 1000)
+#define SWITCH_LONG_US		((int64_t)CONFIG_LED_SWITCH_LONG_MS * 1000)
+#define SWITCH_DIM_PERIOD	100		//ms between dimming steps
+#define SWITCH_DIM_STEP		5		//brightness change per step
+#define SWITCH_DIM_MIN		5		//the lowest brightness of dimming
+
+static volatile int64_t switch_edge_time = 0;	//last accepted edge [us]
+static volatile bool switch_pressed = false;	//debounced state
+static bool switch_held = false;		//press is handled by LED task
+static bool switch_long = false;		//long press, dimming
+static bool switch_turned_on = false;	//light switched ON by this press
+static bool switch_dim_up = false;		//direction of the last dimming
+static int64_t switch_press_time = 0;	//us
+static int64_t switch_next_step = 0;	//next dimming step [us]
+static int64_t switch_latency_max = 0;	//edge to LEDC fade start [us]
+
+void switch_init(void);
+void switch_isr(void *arg);
+void switch_handle(uint32_t events);
+TickType_t switch_wait(void);
+#endif
+
 //other functions
-void read_nvs_data(bool read_default);
+static nvs_record_t nvs_shadow;		//values written in flash
+static uint8_t nvs_missing = 0;		//NVS_xxx keys not found in flash
+static uint32_t nvs_generation = 0;	//number of writes since start
+void read_nvs_data(void);
+uint8_t restore_nvs_data(void);
 void write_nvs_data(void);
+int8_t notify_prop(property_t *prop);
+void notify_changed(uint8_t changed);
+void notify_fun(void *param);
+int16_t timer_start(int duration);
+
+//hand messages over to the notifier task, the LED task and timer
+//callbacks are never blocked by slow subscribers
+static inline void notify_post(uint32_t messages){
+	xTaskNotify(notify_task, messages, eSetBits);
+}
+
+#ifdef CONFIG_LED_CMD_STATS
+//------ command path statistics
+//latency histogram, every octave [2^n, 2^(n+1)) us is split into 8 linear
+//sub-buckets, percentiles are reported with less than 12.5% error
+#define STATS_SUB_BITS	3
+#define STATS_SUB		(1 << STATS_SUB_BITS)
+#define STATS_MAX_US	((1 << 22) - 1)	//longer commands counted in the last bucket
+#define STATS_BUCKETS	((22 - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+typedef struct {
+	uint32_t commands;
+	uint32_t rejected;
+	uint32_t latency[STATS_BUCKETS];
+	int64_t latency_max;	//us
+	uint32_t notifications;
+	int64_t notify_time;	//us, sum of all notifications
+} cmd_stats_t;
+static cmd_stats_t cmd_stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t stats_period_start = 0;
+void cmd_stats_add(int64_t start, int16_t result);
+void cmd_stats_report(void);
+#endif
 
 
 /***********************************************************
@@ -137,36 +586,34 @@ void write_nvs_data(void);
 * fade up one channel
 * inputs"
 *	- ch - channel number
-*	- brgh - brightness [0 .. 100]
+*	- duty - PWM duty [0 .. LEDC_MAX_DUTY]
 *	- ft - fade time [miliseconds]
 *
 ************************************************************/
-int8_t fade_up_channel(ledc_channel_t ch, int32_t brgh, int32_t ft){
-	int32_t duty;
+int8_t fade_up_channel(ledc_channel_t ch, uint32_t duty, int32_t ft){
+	int64_t now, end;
 	
-	if (brgh != 0){
-		duty = (brgh * 8191)/100;
-	}
-	else{
-		duty = 0;
+	if (ledc_is_idle == true){
+		ledc_idle_exit();
 	}
+	channel_duty[ch] = duty;
 	//fade_counter++;
 	ledc_set_fade_with_time(LEDC_HIGH_SPEED_MODE, ch, duty, (uint32_t)ft);
     ledc_fade_start(LEDC_HIGH_SPEED_MODE, ch, LEDC_FADE_NO_WAIT);
     
     if (fade_is_running == false){
     	fade_is_running = true;
-    	//unblock "fade_is_ruuning" after fade finished
-   		fade_timer = xTimerCreate("fade_timer",
-								pdMS_TO_TICKS(ft) + 5,
-								pdFALSE,
-								pdFALSE,
-								fade_timer_fun);
-
-	
-		if (xTimerStart(fade_timer, 0) == pdFAIL){
-			printf("fade timer failed\n");
-		}
+    	xTaskNotify(led_task, LED_EV_FADE, eSetBits);
+    }
+	//unblock "fade_is_running" after the fade finished, the new fade
+	//replaces the running one of this channel, the other channel may
+	//still fade longer, timer is created once and started with new period
+	now = esp_timer_get_time();
+	fade_end[ch] = now + (int64_t)ft * 1000;
+	end = (fade_end[LEDC_CHANNEL_A] > fade_end[LEDC_CHANNEL_B]) ?
+			fade_end[LEDC_CHANNEL_A] : fade_end[LEDC_CHANNEL_B];
+	if (xTimerChangePeriod(fade_timer, pdMS_TO_TICKS((end - now) / 1000) + 5, 0) == pdFAIL){
+		printf("fade timer failed\n");
 	}
     
     return 1;
@@ -179,470 +626,2141 @@ int8_t fade_up_channel(ledc_channel_t ch, int32_t brgh, int32_t ft){
  *
  ******************************************/
 void fade_timer_fun(TimerHandle_t xTimer){
+	bool apply_done = false;
+#ifdef CONFIG_LED_DIAGNOSTICS
+	int64_t start = esp_timer_get_time();
+#endif
 	
-	xSemaphoreTake(led_mux, portMAX_DELAY);
-	fade_is_running = false;
-	xSemaphoreGive(led_mux);
+	led_lock();
+	if ((channel_duty[LEDC_CHANNEL_A] == 0) && (channel_duty[LEDC_CHANNEL_B] == 0) &&
+		((ledc_get_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_A) != 0) ||
+		(ledc_get_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_B) != 0))){
+		//outputs are still lit, LEDC is stopped only in the dark
+		xTimerChangePeriod(fade_timer, 2, 0);
+	}
+	else{
+		if ((channel_duty[LEDC_CHANNEL_A] == 0) && (channel_duty[LEDC_CHANNEL_B] == 0)){
+			//fade out finished
+			ledc_idle_enter();
+		}
+		fade_is_running = false;
+		apply_done = apply_is_running;
+		apply_is_running = false;
+	}
+	led_unlock();
 	
-	xTimerDelete(xTimer, 10); //delete timer
+	if (apply_done == true){
+		notify_post(NTF_APPLY_DONE);
+	}
+#ifdef CONFIG_LED_DIAGNOSTICS
+	diag_time_add(&diag_fade_cb, start);
+#endif
 }
 
 
-/* ****************************************************************
+/*******************************************************************
  *
- * set fading time in milisecond, range 100 .. 10000 msec
+ * both channels are dark: stop channels and LEDC timer and allow
+ * CPU to lower its frequency and sleep, led_mux must be taken
  *
- * ****************************************************************/
-int16_t fade_time_set(char *name, char *new_value_str){
-	int32_t ft;
-	int16_t result = 0;
+ * *****************************************************************/
+void ledc_idle_enter(void){
+	int64_t now;
 	
-	xSemaphoreTake(led_mux, portMAX_DELAY);
-	if (fade_is_running == true){
-		xSemaphoreGive(led_mux);
-		return -1;
+	if (ledc_is_idle == true){
+		return;
 	}
+#ifdef CONFIG_LED_IDLE_POWER_SAVE
+	ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_A, 0);
+	ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_B, 0);
+	ledc_timer_pause(LEDC_HIGH_SPEED_MODE, LEDC_TIMER_0);
+#ifdef CONFIG_PM_ENABLE
+	esp_pm_lock_release(pm_apb_lock);
+	esp_pm_lock_release(pm_sleep_lock);
+#endif
+#endif
+	now = esp_timer_get_time();
+	active_time += now - power_state_since;
+	power_state_since = now;
+	ledc_is_idle = true;
+}
 
-	ft = atoi(new_value_str);
-	if (ft > 10000){
-		ft = 10000;
-	}
-	else if (ft < 100){
-		ft = 100;
-	}
 
-	if (fade_time != ft){
-		fade_time = ft;
-		result = 1;
+/*******************************************************************
+ *
+ * resume LEDC before the first fade, both channels start from duty 0
+ * so there is no glitch on outputs, led_mux must be taken
+ *
+ * *****************************************************************/
+void ledc_idle_exit(void){
+	int64_t now;
+	
+	if (ledc_is_idle == false){
+		return;
 	}
-	xSemaphoreGive(led_mux);
-
-	return result;
+#ifdef CONFIG_LED_IDLE_POWER_SAVE
+#ifdef CONFIG_PM_ENABLE
+	esp_pm_lock_acquire(pm_apb_lock);
+	esp_pm_lock_acquire(pm_sleep_lock);
+#endif
+	ledc_timer_resume(LEDC_HIGH_SPEED_MODE, LEDC_TIMER_0);
+#endif
+	now = esp_timer_get_time();
+	idle_time += now - power_state_since;
+	power_state_since = now;
+	ledc_is_idle = false;
+	xTaskNotify(led_task, LED_EV_WAKE, eSetBits);
 }
 
 
-/* ****************************************************************
- *
- * set brightness
+#ifdef CONFIG_LED_LOAD_MANAGER
+/*******************************************************************
  *
+ * scale both duties down when combined load exceeds PSU budget,
+ * proportion of channels (color temperature) is kept
  * output:
- *		0 - value not changed
- *		1 - new value set, all clients will be informed
- *	   -1 - error
+ *		true - duties are limited
  *
- * ****************************************************************/
-int16_t brightness_set(char *name, char *new_value_str){
-	int32_t brgh;
-	int16_t result = 0;
-	
-	xSemaphoreTake(led_mux, portMAX_DELAY);
+ * *****************************************************************/
+static bool load_scale(uint32_t *duty_a, uint32_t *duty_b){
+	uint32_t load = *duty_a * LOAD_W_A + *duty_b * LOAD_W_B;
 	
-	if (fade_is_running == true){
-		xSemaphoreGive(led_mux);
-		return -1;
+	if (load <= LOAD_BUDGET){
+		return false;
 	}
+	*duty_a = ((uint64_t)*duty_a * LOAD_BUDGET) / load;
+	*duty_b = ((uint64_t)*duty_b * LOAD_BUDGET) / load;
+	load_limited++;
+	return true;
+}
 
-	brgh = atoi(new_value_str);
-	if (brgh > 100){
-		brgh = 100;
+
+/*******************************************************************
+ *
+ * limit new duties to PSU budget and slow down rising ramp, both
+ * channels fade together with the same time, so combined load
+ * changes linearly and never exceeds the budget, led_mux must be
+ * taken
+ * output:
+ *		fade time for both channels [ms]
+ *
+ * *****************************************************************/
+static int32_t load_limit(uint32_t *duty_a, uint32_t *duty_b, int32_t ft){
+	uint32_t load, prev, min_ft;
+	
+	//a replaced fade continues from the present output, not its target
+	prev = ledc_get_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_A) * LOAD_W_A +
+			ledc_get_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_B) * LOAD_W_B;
+	if (load_scale(duty_a, duty_b) == true){
+		printf("leds load: limited to %u W\n", CONFIG_LED_LOAD_PSU_WATTS);
 	}
-	else if (brgh < 0){
-		brgh = 0;
+	load = *duty_a * LOAD_W_A + *duty_b * LOAD_W_B;
+	if (load > load_peak){
+		load_peak = load;
 	}
+	if (load > prev){
+		//inrush: full budget not faster than LOAD_RAMP_MS
+		min_ft = ((uint64_t)(load - prev) * LOAD_RAMP_MS) / LOAD_BUDGET;
+		if (ft < (int32_t)min_ft){
+			ft = min_ft;
+		}
+	}
+	return ft;
+}
+#endif
+
+
+/*******************************************************************
+ *
+ * the highest combined load of both channels [mW] and number of
+ * transitions (and stream frames) limited to PSU budget, zeros
+ * without load manager
+ *
+ * *****************************************************************/
+void get_led_load_stats(uint32_t *peak_mw, uint32_t *limited){
+#ifdef CONFIG_LED_LOAD_MANAGER
+	led_lock();
+	*peak_mw = ((uint64_t)load_peak * 1000) / LEDC_MAX_DUTY;
+	*limited = load_limited;
+	led_unlock();
+#else
+	*peak_mw = 0;
+	*limited = 0;
+#endif
+}
 
-	if (brightness != brgh){
-		brightness = brgh;
-		result = 1;
+
+/*******************************************************************
+ *
+ * time spent with LEDC active and idle since start [ms]
+ *
+ * *****************************************************************/
+void get_led_power_stats(uint64_t *active_ms, uint64_t *idle_ms){
+	int64_t now;
+	
+	led_lock();
+	now = esp_timer_get_time();
+	*active_ms = active_time;
+	*idle_ms = idle_time;
+	if (ledc_is_idle == true){
+		*idle_ms += now - power_state_since;
 	}
+	else{
+		*active_ms += now - power_state_since;
+	}
+	led_unlock();
+	*active_ms /= 1000;
+	*idle_ms /= 1000;
+}
+
+
+/*******************************************************************
+ *
+ * precompute CCT mixing table, entry n is the fraction of the cool
+ * channel for (CCT_WARM + n * CCT_STEP) kelvins in CCT_FRAC_BITS
+ * fixed point, mixing is linear in mireds (1e6 / T)
+ *
+ * *****************************************************************/
+void cct_table_init(void){
+	int32_t mired_warm = 1000000 / CCT_WARM;
+	int32_t mired_cool = 1000000 / CCT_COOL;
+	int32_t t, mired;
 	
-	//set new brightness if device is on
-	if (device_is_on == true){
-		switch (current_channel){
-			case CH_A:
-				//set channel A
-				fade_up_channel(LEDC_CHANNEL_A, brgh, fade_time);
-				break;
-				
-			case CH_B:
-				//set channel B
-				fade_up_channel(LEDC_CHANNEL_B, brgh, fade_time);
-				break;
-				
-			case CH_AB:
-			default:
-				//set channel A and B
-				fade_up_channel(LEDC_CHANNEL_A, brgh, fade_time);
-				//wait a bit
-				vTaskDelay(20 / portTICK_PERIOD_MS);
-				fade_up_channel(LEDC_CHANNEL_B, brgh, fade_time);
+	for (int i = 0; i < CCT_TAB_LEN; i++){
+		t = CCT_WARM + i * CCT_STEP;
+		if (t > CCT_COOL){
+			t = CCT_COOL;
 		}
+		mired = 1000000 / t;
+		cct_tab[i] = ((mired_warm - mired) << CCT_FRAC_BITS) /
+						(mired_warm - mired_cool);
 	}
-	//fade_counter = 0;
-	xSemaphoreGive(led_mux);
+}
 
-	return result;
+
+/*******************************************************************
+ *
+ * split total duty into warm (A) and cool (B) channel for the given
+ * color temperature, sum of both duties (total lumen) is constant
+ *
+ * *****************************************************************/
+void cct_mix(int32_t kelvin, uint32_t total, uint32_t *warm, uint32_t *cool){
+	int32_t idx, rem, frac;
+	
+	idx = (kelvin - CCT_WARM) / CCT_STEP;
+	rem = (kelvin - CCT_WARM) % CCT_STEP;
+	frac = cct_tab[idx] + (((int32_t)cct_tab[idx + 1] - cct_tab[idx]) * rem) / CCT_STEP;
+	
+	*cool = (total * frac) >> CCT_FRAC_BITS;
+	*warm = total - *cool;
 }
 
 
-/* *****************************************************************
+/*******************************************************************
  *
- * turn the device ON or OFF
+ * duties of both channels for the given brightness in the current
+ * channel mode and color temperature
+ *
+ * *****************************************************************/
+void light_duty(int32_t brgh, uint32_t *duty_a, uint32_t *duty_b){
+	uint32_t total = (brgh * LEDC_MAX_DUTY) / 100;
+	
+	*duty_a = 0;
+	*duty_b = 0;
+	if (current_channel == CH_CCT){
+		cct_mix(color_temp, total, duty_a, duty_b);
+	}
+	else{
+		if (current_channel != CH_B){
+			*duty_a = total;
+		}
+		if (current_channel != CH_A){
+			*duty_b = total;
+		}
+	}
+}
+
+
+#ifdef CONFIG_LED_LOAD_MANAGER
+/*******************************************************************
  *
+ * limit brightness to the highest value which combined load of the
+ * current channel mode and color temperature fits in PSU budget,
+ * led_mux must be taken
  * output:
- *		0 - value not changed
- *		1 - new value set, all clients will be informed
- *	   -1 - error
+ *		true - brightness is changed
  *
  * *****************************************************************/
-int16_t set_on_off(char *name, char *new_value_str){
-	int32_t brgh = 0;
-	bool state_change = false;
-	int16_t result = 0;
-
-	xSemaphoreTake(led_mux, portMAX_DELAY);
-	if (fade_is_running == true){
-		//fade action is running
-		xSemaphoreGive(led_mux);
-		return -1;
+static bool load_limit_brightness(void){
+	uint32_t duty_a, duty_b;
+	int32_t brgh = brightness;
+	
+	do {
+		light_duty(brgh, &duty_a, &duty_b);
+	} while ((duty_a * LOAD_W_A + duty_b * LOAD_W_B > LOAD_BUDGET) && (--brgh > 0));
+	if (brgh == brightness){
+		return false;
 	}
+	printf("leds load: brightness limited to %i%%\n", brgh);
+	brightness = brgh;
+	return true;
+}
+#endif
+
+
+/*******************************************************************
+ *
+ * start transition of both channels to the current light state
+ * (device on/off, channel, brightness and color temperature), only
+ * channels which duty changes are faded, led_mux must be taken
+ *
+ * *****************************************************************/
+void light_transition(void){
+	uint32_t duty_a = 0, duty_b = 0;
+	int32_t ft = fade_time;
+	bool fade_a, fade_b;
 	
-	if (strcmp(new_value_str, "true") == 0){
-		//switch ON
-		if (device_is_on == false){
-			device_is_on = true;
-			brgh = brightness;
-			state_change = true;
-		}
+	if (stream_active == true){
+		//new state is applied when stream is finished
+		return;
 	}
-	else if (strcmp(new_value_str, "false") == 0){
-		//switch OFF
-		if (device_is_on == true){
-			device_is_on = false;
-			brgh = 0;
-			state_change = true;
-		}
+	if (device_is_on == true){
+		light_duty(brightness, &duty_a, &duty_b);
 	}
-	else{
-		//error
-		xSemaphoreGive(led_mux);
-		return -1;
+#ifdef CONFIG_LED_LOAD_MANAGER
+	ft = load_limit(&duty_a, &duty_b, ft);
+#endif
+	fade_a = (duty_a != channel_duty[LEDC_CHANNEL_A]);
+	fade_b = (duty_b != channel_duty[LEDC_CHANNEL_B]);
+	if ((fade_a == true) || (fade_b == true)){
+		transition_start = esp_timer_get_time();
+	}
+
+	if (fade_a == true){
+		fade_up_channel(LEDC_CHANNEL_A, duty_a, ft);
+	}
+#ifndef CONFIG_LED_LOAD_MANAGER
+	if ((fade_a == true) && (fade_b == true) && (current_channel != CH_CCT)){
+		//wait a bit, in CCT mode both channels fade synchronously
+		vTaskDelay(20 / portTICK_PERIOD_MS);
 	}
+#endif
+	if (fade_b == true){
+		fade_up_channel(LEDC_CHANNEL_B, duty_b, ft);
+	}
+}
+
+
+/*******************************************************************
+ *
+ * set new light properties, values not marked in "mask" are
+ * not changed, led_mux must be taken
+ * output:
+ *		mask of properties which are changed
+ *
+ * *****************************************************************/
+uint8_t light_update(const light_req_t *req){
+	uint8_t changed = 0;
 	
-	if (state_change == true){
-		//turn channel ON/OFF
-		switch (current_channel){
-			case CH_A:
-				fade_up_channel(LEDC_CHANNEL_A, brgh, fade_time);
-				break;
-					
-			case CH_B:
-				fade_up_channel(LEDC_CHANNEL_B, brgh, fade_time);
-				break;
-				
-			case CH_AB:
-			default:
-				//start channel A
-				fade_up_channel(LEDC_CHANNEL_A, brgh, fade_time);
-				//wait a bit
-				vTaskDelay(20 / portTICK_PERIOD_MS);
-				//start channel B
-				fade_up_channel(LEDC_CHANNEL_B, brgh, fade_time);
-		}
-		//TODO: stop can be executed after fade up finished
-		//if (brgh == 0){	
-		//	ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_A, 0);
-		//	ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_B, 0);
-		//}
-		if (device_is_on == false){
-			write_nvs_data();
-		}
-		result = 1;
+	if (((req -> mask & LIGHT_ON) != 0) && (req -> on != device_is_on)){
+		//count ON time exactly to this moment
+		on_time_accumulate(esp_timer_get_time());
+		device_is_on = req -> on;
+		changed |= LIGHT_ON;
 	}
-	else{
-		result = 0;
+	if (((req -> mask & LIGHT_CHANNEL) != 0) && (req -> channel != current_channel)){
+		prev_current_channel = current_channel;
+		current_channel = req -> channel;
+		prop_channel -> value = (char *)channel_tab[current_channel];
+		changed |= LIGHT_CHANNEL;
+	}
+	if (((req -> mask & LIGHT_BRGH) != 0) && (req -> brightness != brightness)){
+		brightness = req -> brightness;
+		changed |= LIGHT_BRGH;
+	}
+	if (((req -> mask & LIGHT_FADE) != 0) && (req -> fade_time != fade_time)){
+		fade_time = req -> fade_time;
+		changed |= LIGHT_FADE;
 	}
+	if (((req -> mask & LIGHT_CCT) != 0) && (req -> color_temp != color_temp)){
+		color_temp = req -> color_temp;
+		changed |= LIGHT_CCT;
+	}
+#ifdef CONFIG_LED_LOAD_MANAGER
+	if (((changed & (LIGHT_CHANNEL | LIGHT_BRGH | LIGHT_CCT)) != 0) &&
+		(load_limit_brightness() == true)){
+		changed |= LIGHT_BRGH;
+	}
+#endif
 	
-	xSemaphoreGive(led_mux);	
+	if ((changed & (LIGHT_ON | LIGHT_CHANNEL | LIGHT_BRGH | LIGHT_CCT)) != 0){
+		light_transition();
+	}
 	
-	return result;
+	return changed;
 }
 
 
-/******************************************************
+/*******************************************************************
  *
- * timer is finished, turn all channels OFF
+ * set new light properties if no fade is running, when device is
+ * switched OFF data are written into NVS
+ * output:
+ *		mask of properties which are changed
+ *	   -1 - fade is running, nothing is changed
  *
- * *****************************************************/
-void timer_fun(TimerHandle_t xTimer){
-	bool state_changed = false;
+ * *****************************************************************/
+int16_t light_apply(const light_req_t *req){
+	uint8_t changed;
 	
-	complete_action(0, "timer", ACT_COMPLETED);
+	led_lock();
+	if ((fade_is_running == true) || (stream_active == true)){
+		led_unlock();
+		return -1;
+	}
+	changed = light_update(req);
+	if (((changed & LIGHT_ON) != 0) && (device_is_on == false)){
+		write_nvs_data();
+	}
+	led_unlock();
 	
-	xSemaphoreTake(led_mux, portMAX_DELAY);
+	return changed;
+}
 
-	if (device_is_on == true){
-		//switch OFF both channels
-		device_is_on = false;
-		switch (current_channel){
-			case CH_A:
-				fade_up_channel(LEDC_CHANNEL_A, 0, fade_time);
-				break;
-				
-			case CH_B:
-				fade_up_channel(LEDC_CHANNEL_B, 0, fade_time);
-				break;
-				
-			case CH_AB:
-			default:
-				//start channel A
-				fade_up_channel(LEDC_CHANNEL_A, 0, fade_time);
-				//wait a bit
-				vTaskDelay(20 / portTICK_PERIOD_MS);
-				//start channel B
-				fade_up_channel(LEDC_CHANNEL_B, 0, fade_time);
-		}
-		state_changed = true;
+
+/*******************************************************************
+ *
+ * set new light properties also when fade is running (the fade
+ * is replaced), used by local and scheduled commands which must
+ * not be rejected, when device is switched OFF data are written
+ * into NVS
+ * output:
+ *		mask of properties which are changed
+ *	   -1 - streaming is active, nothing is changed
+ *
+ * *****************************************************************/
+int16_t light_force(const light_req_t *req){
+	uint8_t changed;
+	
+	led_lock();
+	if (stream_active == true){
+		led_unlock();
+		return -1;
 	}
-	xSemaphoreGive(led_mux);
+	changed = light_update(req);
+	if (((changed & LIGHT_ON) != 0) && (device_is_on == false)){
+		write_nvs_data();
+	}
+	led_unlock();
 	
-	//fade_counter = 0;
+	return changed;
+}
+
+
+/* ****************************************************************
+ *
+ * range limits of the properties
+ *
+ * ****************************************************************/
+static int32_t limit_fade_time(int32_t ft){
+	if (ft > 10000){
+		ft = 10000;
+	}
+	else if (ft < 100){
+		ft = 100;
+	}
+	return ft;
+}
+
+static int32_t limit_brightness(int32_t brgh){
+	if (brgh > 100){
+		brgh = 100;
+	}
+	else if (brgh < 0){
+		brgh = 0;
+	}
+	return brgh;
+}
+
+static int32_t limit_color_temp(int32_t ct){
+	if (ct > CCT_COOL){
+		ct = CCT_COOL;
+	}
+	else if (ct < CCT_WARM){
+		ct = CCT_WARM;
+	}
+	return ct;
+}
+
+
+/* ****************************************************************
+ *
+ * find channel by its name (e.g. "A+B"), input:
+ *	- str - channel name, not null terminated
+ *	- len - name length
+ * output:
+ *	channel index or -1 if name is unknown
+ *
+ * ****************************************************************/
+static int find_channel(const char *str, int len){
+	for (int i = 0; i < CH_NUMBER; i++){
+		if ((strlen(channel_tab[i]) == len) &&
+			(strncmp(str, channel_tab[i], len) == 0)){
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/* ****************************************************************
+ *
+ * set fading time in milisecond, range 100 .. 10000 msec
+ *
+ * ****************************************************************/
+int16_t fade_time_set(char *name, char *new_value_str){
+	light_req_t req = {.mask = LIGHT_FADE};
+	int16_t res;
+	
+	req.fade_time = limit_fade_time(atoi(new_value_str));
+	res = light_apply(&req);
+	if (res > 0){
+		res = 1;
+	}
+
+	return res;
+}
+
+
+/* ****************************************************************
+ *
+ * set color temperature, used only in CCT channel mode
+ *
+ * ****************************************************************/
+int16_t color_temp_set(char *name, char *new_value_str){
+	light_req_t req = {.mask = LIGHT_CCT};
+	int16_t res;
+	
+	req.color_temp = limit_color_temp(atoi(new_value_str));
+	res = light_apply(&req);
+	if (res > 0){
+		if ((res & LIGHT_BRGH) != 0){
+			//brightness limited to PSU budget
+			notify_post(LIGHT_BRGH);
+		}
+		res = 1;
+	}
+
+	return res;
+}
+
+
+/* ****************************************************************
+ *
+ * set brightness
+ *
+ * output:
+ *		0 - value not changed
+ *		1 - new value set, all clients will be informed
+ *	   -1 - error
+ *
+ * ****************************************************************/
+int16_t brightness_set(char *name, char *new_value_str){
+	light_req_t req = {.mask = LIGHT_BRGH};
+	int16_t res;
+	
+	req.brightness = limit_brightness(atoi(new_value_str));
+	res = light_apply(&req);
+	if (res > 0){
+		res = 1;
+	}
+
+	return res;
+}
+
+
+/* *****************************************************************
+ *
+ * turn the device ON or OFF
+ *
+ * output:
+ *		0 - value not changed
+ *		1 - new value set, all clients will be informed
+ *	   -1 - error
+ *
+ * *****************************************************************/
+int16_t set_on_off(char *name, char *new_value_str){
+	light_req_t req = {.mask = LIGHT_ON};
+	int16_t res;
+	
+	if (strcmp(new_value_str, "true") == 0){
+		req.on = true;
+	}
+	else if (strcmp(new_value_str, "false") == 0){
+		req.on = false;
+	}
+	else{
+		//error
+		return -1;
+	}
+	//LEDC is stopped in fade_timer_fun() after fade out finished
+	res = light_apply(&req);
+	if (res > 0){
+		res = 1;
+	}
+	
+	return res;
+}
+
+
+/******************************************************
+ *
+ * timer is finished, turn all channels OFF
+ *
+ * *****************************************************/
+void timer_fun(TimerHandle_t xTimer){
+	light_req_t req = {.mask = LIGHT_ON, .on = false};
+	uint8_t changed, restored = 0;
+#ifdef CONFIG_LED_DIAGNOSTICS
+	int64_t start = esp_timer_get_time();
+#endif
+	
+	led_lock();
+	changed = light_update(&req);
+	if (changed != 0){
+		//restore persisted properties from RAM, flash is not read
+		//in the timer service task
+		restored = restore_nvs_data();
+		prop_channel -> value = (char *)channel_tab[current_channel];
+#ifdef CONFIG_LED_LOAD_MANAGER
+		//NVS data may be saved before the budget was changed
+		if (load_limit_brightness() == true){
+			restored |= LIGHT_BRGH;
+		}
+#endif
+	}
+	led_unlock();
+	
+	//fade_counter = 0;
+	
+	timer_is_running = false;
+	
+	//complete the action and inform clients about changed properties
+	notify_post(NTF_TIMER_DONE | changed | restored);
+#ifdef CONFIG_LED_DIAGNOSTICS
+	diag_time_add(&diag_timer_cb, start);
+#endif
+}
+
+
+/**********************************************************
+ *
+ * timer action
+ * inputs:
+ * 		- minutes of turn OFF in json, e.g.: "duration":10
+ *
+ * *******************************************************/
+int16_t timer_run(char *inputs){
+	int duration = 0, len;
+	char *p1, buff[6];
+
+	//get duration value
+	p1 = strstr(inputs, "duration");
+	if (p1 == NULL){
+		goto inputs_error;
+	}
+	p1 = strchr(p1, ':');
+	if (p1 == NULL){
+		goto inputs_error;
+	}
+	len = strlen(inputs) - (p1 + 1 - inputs);
+	if (len > 5){
+		goto inputs_error;
+	}
+	memset(buff, 0, 6);
+	memcpy(buff, p1 + 1, len);
+	duration = atoi(buff);
+	if (timer_start(duration) < 0){
+		goto inputs_error;
+	}
+
+	return 0;
+
+	inputs_error:
+		printf("timer ERROR\n");
+	return -1;
+}
+
+
+/**********************************************************
+ *
+ * turn device ON (if it is OFF) for the given time
+ * inputs:
+ * 		- duration - minutes, 1 .. 600
+ * output:
+ *		0 - timer started, -1 - error
+ *
+ * *******************************************************/
+int16_t timer_start(int duration){
+	light_req_t req = {.mask = LIGHT_ON, .on = true};
+	uint8_t changed;
+
+	if ((timer_is_running == true) || (duration > 600) || (duration <= 0)){
+		return -1;
+	}
+	
+	led_lock();
+	//if device is OFF switch it ON now
+	changed = light_update(&req);
+	led_unlock();
+	
+	//start timer with new period
+	if (xTimerChangePeriod(timer, pdMS_TO_TICKS(duration * 60 * 1000), 5) == pdFAIL){
+		printf("timer failed\n");
+	}
+	else{
+		timer_is_running = true;
+		//also called by the binary task, it must not wait for subscribers
+		notify_post(changed);
+	}
+
+	return 0;
+}
+
+
+/**********************************************************
+ *
+ * find value of the key in json inputs, e.g. for key "on"
+ * and inputs {"on":true,"brightness":50} returns "true,..."
+ * output:
+ *		pointer to the first character of the value or NULL
+ *
+ * *******************************************************/
+static char *json_value(char *inputs, const char *key){
+	char *p1 = inputs;
+	int len = strlen(key);
+	
+	while ((p1 = strstr(p1, key)) != NULL){
+		//key must be quoted, "fade-time" must not match "time"
+		if ((p1 > inputs) && (*(p1 - 1) == '"') && (*(p1 + len) == '"')){
+			p1 = strchr(p1 + len, ':');
+			if (p1 == NULL){
+				return NULL;
+			}
+			p1++;
+			while (*p1 == ' '){
+				p1++;
+			}
+			return p1;
+		}
+		p1 += len;
+	}
+	return NULL;
+}
+
+
+/**********************************************************
+ *
+ * integer value found by json_value(), the number must be
+ * followed by ',', '}', space or the end of inputs, quoted
+ * numbers are not accepted
+ * output:
+ *		0 - ok, -1 - not a number
+ *
+ * *******************************************************/
+static int json_number(const char *p1, int32_t *value){
+	char *end;
+	long v;
+	
+	v = strtol(p1, &end, 10);
+	if ((end == p1) || ((*end != ',') && (*end != '}') && (*end != ' ') &&
+		(*end != '\0'))){
+		return -1;
+	}
+	if (v > INT32_MAX){
+		v = INT32_MAX;
+	}
+	else if (v < INT32_MIN){
+		v = INT32_MIN;
+	}
+	*value = v;
+	return 0;
+}
+
+
+/**********************************************************
+ *
+ * apply action, set any subset of properties in one step
+ * inputs:
+ * 		- json, e.g.: {"on":true,"channel":"A","brightness":60}
+ *		  allowed keys: "on", "channel", "brightness", "fade-time",
+ *		  "color-temperature"
+ *
+ * all values are validated first, then all properties are
+ * changed under one lock with one transition, the action is
+ * completed when the transition is finished
+ *
+ * *******************************************************/
+int16_t apply_run(char *inputs){
+	light_req_t req = {.mask = 0};
+	char *p1, *p2;
+	int32_t value;
+	int16_t res;
+	bool wait_for_fade;
+	
+	//validate inputs
+	if ((p1 = json_value(inputs, on_prop_id)) != NULL){
+		req.mask |= LIGHT_ON;
+		if (strncmp(p1, "true", 4) == 0){
+			req.on = true;
+		}
+		else if (strncmp(p1, "false", 5) == 0){
+			req.on = false;
+		}
+		else{
+			goto inputs_error;
+		}
+	}
+	if ((p1 = json_value(inputs, channel_prop_id)) != NULL){
+		int ch;
+		
+		req.mask |= LIGHT_CHANNEL;
+		if ((*p1 != '"') || ((p2 = strchr(p1 + 1, '"')) == NULL)){
+			goto inputs_error;
+		}
+		ch = find_channel(p1 + 1, p2 - p1 - 1);
+		if (ch < 0){
+			goto inputs_error;
+		}
+		req.channel = ch;
+	}
+	if ((p1 = json_value(inputs, brgh_id)) != NULL){
+		req.mask |= LIGHT_BRGH;
+		if (json_number(p1, &value) < 0){
+			goto inputs_error;
+		}
+		req.brightness = limit_brightness(value);
+	}
+	if ((p1 = json_value(inputs, fade_time_id)) != NULL){
+		req.mask |= LIGHT_FADE;
+		if (json_number(p1, &value) < 0){
+			goto inputs_error;
+		}
+		req.fade_time = limit_fade_time(value);
+	}
+	if ((p1 = json_value(inputs, color_temp_id)) != NULL){
+		req.mask |= LIGHT_CCT;
+		if (json_number(p1, &value) < 0){
+			goto inputs_error;
+		}
+		req.color_temp = limit_color_temp(value);
+	}
+	if (req.mask == 0){
+		goto inputs_error;
+	}
+	
+	//one lock, one transition
+	led_lock();
+	if ((fade_is_running == true) || (apply_is_running == true) ||
+		(stream_active == true)){
+		led_unlock();
+		goto inputs_error;
+	}
+	res = light_update(&req);
+	if (((res & LIGHT_ON) != 0) && (device_is_on == false)){
+		write_nvs_data();
+	}
+	//action is completed when fade timer expires
+	wait_for_fade = fade_is_running;
+	apply_is_running = wait_for_fade;
+	led_unlock();
+	
+	if (wait_for_fade == false){
+		notify_post(NTF_APPLY_DONE);
+	}
+	
+	//inform clients about every changed property once
+	notify_changed(res);
+	
+	return 0;
+	
+	inputs_error:
+		printf("apply ERROR\n");
+	return -1;
+}
+
+
+/*******************************************************************
+*
+* set channel, called after http PUT method
+* output:
+*	0 - value is ok, but not changed (the same as previous one)
+*	1 - value is changed, subscribers will be informed
+*  -1 - error
+*
+*******************************************************************/
+int16_t set_channel(char *name, char *new_value_str){
+	light_req_t req = {.mask = LIGHT_CHANNEL};
+	char *str = new_value_str;
+	int ch, len;
+	int16_t result = 0;
+	
+	//in websocket quotation mark is not removed
+	//(in http should be the same but is not)
+	if (new_value_str[0] == '"'){
+		str = new_value_str + 1;
+		char *ptr = strchr(str, '"');
+		if (ptr == NULL){
+			return -1;
+		}
+		len = ptr - str;
+	}
+	else{
+		len = strlen(new_value_str);
+	}
+	
+	//set channel, if channel is changed when device is ON then switch OFF
+	//previous channel and switch ON new channel
+	ch = find_channel(str, len);
+	if (ch < 0){
+		result = -1;
+	}
+	else{
+		req.channel = ch;
+		result = light_apply(&req);
+		if (result > 0){
+			if ((result & LIGHT_BRGH) != 0){
+				//brightness limited to PSU budget
+				notify_post(LIGHT_BRGH);
+			}
+			result = 1;
+		}
+	}
+	
+	return result;
+}
+
+
+#ifdef CONFIG_LED_SWITCH_ENABLE
+/*********************************************************************
+ *
+ * wall switch input, internal pull resistor is used
+ *
+ * ******************************************************************/
+void switch_init(void){
+	gpio_config_t cfg = {
+		.pin_bit_mask = 1ULL << SWITCH_GPIO,
+		.mode = GPIO_MODE_INPUT,
+#ifdef CONFIG_LED_SWITCH_ACTIVE_LOW
+		.pull_up_en = GPIO_PULLUP_ENABLE,
+		.pull_down_en = GPIO_PULLDOWN_DISABLE,
+#else
+		.pull_up_en = GPIO_PULLUP_DISABLE,
+		.pull_down_en = GPIO_PULLDOWN_ENABLE,
+#endif
+		.intr_type = GPIO_INTR_ANYEDGE
+	};
+	esp_err_t err;
+	
+	gpio_config(&cfg);
+	//switch held at start is not a press
+	switch_pressed = (gpio_get_level(SWITCH_GPIO) == SWITCH_ACTIVE);
+	err = gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+	if ((err != ESP_OK) && (err != ESP_ERR_INVALID_STATE)){
+		//ESP_ERR_INVALID_STATE - service installed by application
+		printf("leds switch: ISR service error %d\n", err);
+		return;
+	}
+	gpio_isr_handler_add(SWITCH_GPIO, switch_isr, NULL);
+}
+
+
+/*********************************************************************
+ *
+ * switch edge, the first edge is accepted at once (no latency),
+ * next edges are ignored during debounce time
+ *
+ * ******************************************************************/
+void IRAM_ATTR switch_isr(void *arg){
+	BaseType_t woken = pdFALSE;
+	int64_t now = esp_timer_get_time();
+	bool pressed = (gpio_get_level(SWITCH_GPIO) == SWITCH_ACTIVE);
+	
+	if (((now - switch_edge_time) < SWITCH_DEBOUNCE_US) || (pressed == switch_pressed)){
+		return;
+	}
+	switch_edge_time = now;
+	switch_pressed = pressed;
+#ifdef CONFIG_LED_SWITCH_ROCKER
+	xTaskNotifyFromISR(led_task, LED_EV_SW_TOGGLE, eSetBits, &woken);
+#else
+	xTaskNotifyFromISR(led_task, pressed ? LED_EV_SW_PRESS : LED_EV_SW_RELEASE,
+						eSetBits, &woken);
+#endif
+	if (woken == pdTRUE){
+		portYIELD_FROM_ISR();
+	}
+}
+
+
+/*********************************************************************
+ *
+ * switch light ON or OFF, latency from the switch edge to the
+ * start of LEDC fade is measured, the maximum is shown in
+ * diagnostics
+ *
+ * ******************************************************************/
+static void switch_light(bool on, int64_t edge_time){
+	light_req_t req = {.mask = LIGHT_ON, .on = on};
+	int16_t changed;
+	int64_t latency;
+	
+	changed = light_force(&req);
+	if (changed > 0){
+		//the second channel may start later (A+B stagger)
+		led_lock();
+		latency = transition_start - edge_time;
+		led_unlock();
+		if (latency > switch_latency_max){
+			switch_latency_max = latency;
+		}
+		notify_post(changed);
+	}
+}
+
+
+/*********************************************************************
+ *
+ * one step of dimming, short fade instead of fade-time property,
+ * subscribers are informed when switch is released
+ *
+ * ******************************************************************/
+static void switch_dim_step(void){
+	light_req_t req = {.mask = LIGHT_BRGH};
+	int32_t brgh, ft;
+	
+	led_lock();
+	if ((stream_active == true) || (device_is_on == false)){
+		led_unlock();
+		return;
+	}
+	brgh = brightness + (switch_dim_up ? SWITCH_DIM_STEP : -SWITCH_DIM_STEP);
+	if (brgh < SWITCH_DIM_MIN){
+		brgh = SWITCH_DIM_MIN;
+	}
+	req.brightness = limit_brightness(brgh);
+	ft = fade_time;
+	fade_time = SWITCH_DIM_PERIOD;
+	light_update(&req);
+	fade_time = ft;
+	led_unlock();
+}
+
+
+/*********************************************************************
+ *
+ * switch events in LED task:
+ *	- press when light is OFF - switch ON at once
+ *	- short press when light is ON - switch OFF on release
+ *	- long press - dimming, direction is changed every long press
+ *	- rocker switch - every change toggles the light
+ *
+ * ******************************************************************/
+void switch_handle(uint32_t events){
+	int64_t now = esp_timer_get_time();
+	
+	if ((events & LED_EV_SW_TOGGLE) != 0){
+		switch_light(!device_is_on, switch_edge_time);
+		return;
+	}
+	if ((events & LED_EV_SW_PRESS) != 0){
+		switch_held = true;
+		switch_long = false;
+		switch_press_time = switch_edge_time;
+		switch_turned_on = (device_is_on == false);
+		if (switch_turned_on == true){
+			switch_light(true, switch_press_time);
+		}
+	}
+	if (switch_held == false){
+		return;
+	}
+	
+	if (((events & LED_EV_SW_RELEASE) == 0) &&
+		((now - switch_edge_time) >= SWITCH_DEBOUNCE_US) &&
+		(gpio_get_level(SWITCH_GPIO) != SWITCH_ACTIVE)){
+		//release edge was lost in debounce time
+		switch_pressed = false;
+		events |= LED_EV_SW_RELEASE;
+	}
+	if ((events & LED_EV_SW_RELEASE) != 0){
+		switch_held = false;
+		if (switch_long == true){
+			notify_post(LIGHT_BRGH);
+		}
+		else if (switch_turned_on == false){
+			switch_light(false, switch_edge_time);
+		}
+		return;
+	}
+	
+	if ((now - switch_press_time) < SWITCH_LONG_US){
+		return;
+	}
+	if (switch_long == false){
+		switch_long = true;
+		switch_next_step = now;
+		if (brightness >= 100){
+			switch_dim_up = false;
+		}
+		else if (brightness <= SWITCH_DIM_MIN){
+			switch_dim_up = true;
+		}
+		else{
+			switch_dim_up = !switch_dim_up;
+		}
+	}
+	if (now >= switch_next_step){
+		switch_next_step = now + SWITCH_DIM_PERIOD * 1000;
+		switch_dim_step();
+	}
+}
+
+
+/*********************************************************************
+ *
+ * ticks to the next switch event (long press or dimming step)
+ *
+ * ******************************************************************/
+TickType_t switch_wait(void){
+	int64_t next, now = esp_timer_get_time();
+	
+	if (switch_held == false){
+		return portMAX_DELAY;
+	}
+	next = (switch_long == true) ? switch_next_step : (switch_press_time + SWITCH_LONG_US);
+	if (next <= now){
+		return 0;
+	}
+	return pdMS_TO_TICKS((next - now + 999) / 1000);
+}
+#endif
+
+
+/*********************************************************************
+ *
+ * main task
+ *
+ * ******************************************************************/
+void leds_fun(void *param){
+	
+	TickType_t period = APP_PERIOD / portTICK_PERIOD_MS, elapsed, wait;
+	TickType_t last_wake_time = xTaskGetTickCount() - period;
+	TickType_t level_period = (1000 / CONFIG_LED_LEVEL_RATE_HZ) / portTICK_PERIOD_MS;
+	TickType_t last_level_time = 0;
+	bool level_stream = false;
+	uint32_t events;
+	
+	if (level_period == 0){
+		level_period = 1;
+	}
+	
+	for (;;){
+		//wait for events or for the next period,
+		//when light is OFF and idle only midnight (checked every minute) is awaited
+		elapsed = xTaskGetTickCount() - last_wake_time;
+		wait = (elapsed < period) ? (period - elapsed) : 0;
+		if (level_stream == true){
+			elapsed = xTaskGetTickCount() - last_level_time;
+			if (elapsed >= level_period){
+				wait = 0;
+			}
+			else if ((level_period - elapsed) < wait){
+				wait = level_period - elapsed;
+			}
+		}
+		else if ((ledc_is_idle == true) && (init_data_sent == true)){
+			wait = portMAX_DELAY;
+		}
+		//next minute of ON time, midnight or wall clock check
+		elapsed = on_time_wait();
+		if (elapsed < wait){
+			wait = elapsed;
+		}
+#ifdef CONFIG_LED_SWITCH_ENABLE
+		elapsed = switch_wait();
+		if (elapsed < wait){
+			wait = elapsed;
+		}
+#endif
+		events = 0;
+		xTaskNotifyWait(0, UINT32_MAX, &events, wait);
+		
+#ifdef CONFIG_LED_SWITCH_ENABLE
+		//switch first, the lowest latency
+		switch_handle(events);
+#endif
+		update_on_time(false);
+		
+#ifdef CONFIG_LED_GROUP_SYNC
+		if ((events & LED_EV_GROUP) != 0){
+			group_apply();
+		}
+#endif
+		
+		//send current level not more often than LED_LEVEL_RATE_HZ,
+		//only the latest value is sent, one more after fade is finished
+		if ((events & LED_EV_FADE) != 0){
+			level_stream = true;
+		}
+		if ((level_stream == true) &&
+			((xTaskGetTickCount() - last_level_time) >= level_period)){
+			last_level_time = xTaskGetTickCount();
+			level_stream = fade_is_running;
+			level_update();
+		}
+		
+		if ((xTaskGetTickCount() - last_wake_time) < period){
+			continue;
+		}
+		last_wake_time = xTaskGetTickCount();
+#ifdef CONFIG_LED_CMD_STATS
+		if ((esp_timer_get_time() - stats_period_start) >=
+			(int64_t)CONFIG_LED_CMD_STATS_PERIOD * 1000000){
+			cmd_stats_report();
+		}
+#endif
+#ifdef CONFIG_LED_DIAGNOSTICS
+		diag_update();
+#endif
+		
+		if (init_data_sent == false){
+			notify_post(NTF_INIT);
+		}
+	}
+}
+
+
+/*********************************************************************
+ *
+ * notifier task, sends messages handed over by notify_post(),
+ * a burst of the same message is sent once with the latest value
+ *
+ * ******************************************************************/
+void notify_fun(void *param){
+	uint32_t messages;
+	
+	for (;;){
+		messages = 0;
+		xTaskNotifyWait(0, UINT32_MAX, &messages, portMAX_DELAY);
+		
+		if ((messages & NTF_TIMER_DONE) != 0){
+			complete_action(0, (char *)timer_id, ACT_COMPLETED);
+		}
+		if ((messages & NTF_APPLY_DONE) != 0){
+			complete_action(0, (char *)apply_id, ACT_COMPLETED);
+		}
+		if ((messages & NTF_INIT) != 0){
+			int8_t s1 = notify_prop(prop_channel);
+			int8_t s2 = notify_prop(prop_on);
+			int8_t s3 = notify_prop(prop_daily_on_time);
+			int8_t s4 = notify_prop(prop_brgh);
+			int8_t s5 = notify_prop(prop_fade_time);
+			int8_t s6 = notify_prop(prop_color_temp);
+			int8_t s7 = notify_prop(prop_level_a);
+			int8_t s8 = notify_prop(prop_level_b);
+			int8_t s9 = 0;
+#ifdef CONFIG_LED_DIAGNOSTICS
+			s9 = notify_prop(prop_diag);
+#endif
+			if ((s1 == 0) && (s2 == 0) && (s3 == 0) && (s4 == 0) && (s5 == 0) &&
+				(s6 == 0) && (s7 == 0) && (s8 == 0) && (s9 == 0)){
+				init_data_sent = true;
+			}
+			continue; //everything is sent
+		}
+		notify_changed(messages & NTF_LIGHT);
+		if ((messages & NTF_DAILY_ON) != 0){
+			notify_prop(prop_daily_on_time);
+		}
+		if ((messages & NTF_LEVEL) != 0){
+			notify_prop(prop_level_a);
+			notify_prop(prop_level_b);
+		}
+#ifdef CONFIG_LED_DIAGNOSTICS
+		if ((messages & NTF_DIAG) != 0){
+			notify_prop(prop_diag);
+		}
+#endif
+	}
+}
+
+
+#ifdef CONFIG_LED_DIAGNOSTICS
+/***************************************************************
+*
+* stack high water marks (free bytes) of all tasks used by this
+* thing, durations of timer service callbacks and led_mux hold
+* time (last/max), subscribers are informed if changed
+*
+****************************************************************/
+void diag_update(void){
+	char buff[sizeof(diagnostics)];
+	int len;
+	bool changed = false;
+	
+	len = snprintf(buff, sizeof(buff), "stack leds:%u ntf:%u tmr:%u",
+			(unsigned)uxTaskGetStackHighWaterMark(led_task),
+			(unsigned)uxTaskGetStackHighWaterMark(notify_task),
+			(unsigned)uxTaskGetStackHighWaterMark(xTimerGetTimerDaemonTaskHandle()));
+	//socket tasks are deleted on socket error, the handle is cleared
+	//under led_mux before
+	led_lock();
+#ifdef CONFIG_LED_STREAM_ENABLE
+	if (stream_task != NULL){
+		len += snprintf(buff + len, sizeof(buff) - len, " stream:%u",
+				(unsigned)uxTaskGetStackHighWaterMark(stream_task));
+	}
+#endif
+#ifdef CONFIG_LED_BINARY_ENABLE
+	if (bin_task != NULL){
+		len += snprintf(buff + len, sizeof(buff) - len, " bin:%u",
+				(unsigned)uxTaskGetStackHighWaterMark(bin_task));
+	}
+#endif
+#ifdef CONFIG_LED_SWITCH_ENABLE
+	len += snprintf(buff + len, sizeof(buff) - len, ", switch max:%" PRId64,
+			switch_latency_max);
+#endif
+	snprintf(buff + len, sizeof(buff) - len,
+			", fade cb:%" PRIu32 "/%" PRIu32 " timer cb:%" PRIu32 "/%" PRIu32
+			", mux:%" PRIu32 "/%" PRIu32 ", nvs writes:%" PRIu32,
+			diag_fade_cb.last, diag_fade_cb.max,
+			diag_timer_cb.last, diag_timer_cb.max,
+			diag_mux.last, diag_mux.max, nvs_generation);
+	if (strcmp(buff, diagnostics) != 0){
+		strcpy(diagnostics, buff);
+		changed = true;
+	}
+	led_unlock();
+	
+	if (changed == true){
+		notify_post(NTF_DIAG);
+	}
+}
+#endif
+
+
+/***************************************************************
+*
+* read real duty of both channels, if the level is changed the
+* notifier task informs subscribers
+*
+****************************************************************/
+void level_update(void){
+	int32_t a, b;
+	bool changed = false;
+	
+	a = (ledc_get_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_A) * 100 + LEDC_MAX_DUTY / 2)
+		/ LEDC_MAX_DUTY;
+	b = (ledc_get_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_B) * 100 + LEDC_MAX_DUTY / 2)
+		/ LEDC_MAX_DUTY;
+	
+	led_lock();
+	if ((a != level_a) || (b != level_b)){
+		level_a = a;
+		level_b = b;
+		changed = true;
+	}
+	led_unlock();
+	
+	if (changed == true){
+		notify_post(NTF_LEVEL);
+	}
+}
+
+
+/***************************************************************
+*
+* inform subscribers about all properties marked in the mask
+* of changes (LIGHT_xxx)
+*
+* the server API sends one property per message and owns the
+* subscriber sockets, so a change of several properties is sent
+* as one message per property, each property only once
+*
+****************************************************************/
+void notify_changed(uint8_t changed){
+	if ((changed & LIGHT_ON) != 0){
+		notify_prop(prop_on);
+	}
+	if ((changed & LIGHT_CHANNEL) != 0){
+		notify_prop(prop_channel);
+	}
+	if ((changed & LIGHT_BRGH) != 0){
+		notify_prop(prop_brgh);
+	}
+	if ((changed & LIGHT_FADE) != 0){
+		notify_prop(prop_fade_time);
+	}
+	if ((changed & LIGHT_CCT) != 0){
+		notify_prop(prop_color_temp);
+	}
+}
+
+
+/***************************************************************
+*
+* inform all subscribers about new property value
+* (with command statistics enabled the fan-out time is measured)
+*
+****************************************************************/
+int8_t notify_prop(property_t *prop){
+	if (stream_active == true){
+		//suppressed, all properties are sent after stream
+		return 0;
+	}
+#ifdef CONFIG_LED_CMD_STATS
+	int8_t res;
+	int64_t start = esp_timer_get_time();
+	
+	res = inform_all_subscribers_prop(prop);
+	
+	portENTER_CRITICAL(&stats_lock);
+	cmd_stats.notifications++;
+	cmd_stats.notify_time += esp_timer_get_time() - start;
+	portEXIT_CRITICAL(&stats_lock);
+	
+	return res;
+#else
+	return inform_all_subscribers_prop(prop);
+#endif
+}
+
+
+#ifdef CONFIG_LED_CMD_STATS
+/***************************************************************
+*
+* register one command, inputs:
+*	- start - time when command handler was entered [us]
+*	- result - value returned by the handler, -1 means rejected
+*
+****************************************************************/
+static int stats_bucket(int64_t dt){
+	uint32_t v = (dt < 0) ? 0 : ((dt > STATS_MAX_US) ? STATS_MAX_US : (uint32_t)dt);
+	int msb;
+	
+	if (v < STATS_SUB){
+		return v; //exact below 8 us
+	}
+	msb = 31 - __builtin_clz(v);
+	return ((msb - STATS_SUB_BITS + 1) << STATS_SUB_BITS) +
+			((v >> (msb - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+
+void cmd_stats_add(int64_t start, int16_t result){
+	int64_t dt = esp_timer_get_time() - start;
+	int b = stats_bucket(dt);
+	
+	portENTER_CRITICAL(&stats_lock);
+	cmd_stats.commands++;
+	if (result < 0){
+		cmd_stats.rejected++;
+	}
+	cmd_stats.latency[b]++;
+	if (dt > cmd_stats.latency_max){
+		cmd_stats.latency_max = dt;
+	}
+	portEXIT_CRITICAL(&stats_lock);
+}
+
+
+/***************************************************************
+*
+* upper bound of the latency histogram bucket [us] containing
+* the given percentile
+*
+****************************************************************/
+static uint32_t stats_percentile(const cmd_stats_t *st, uint32_t pct){
+	uint32_t limit, sum = 0;
+	
+	limit = (st -> commands * pct + 99) / 100;
+	for (int b = 0; b < STATS_BUCKETS; b++){
+		sum += st -> latency[b];
+		if ((sum >= limit) && (sum > 0)){
+			int shift = (b >> STATS_SUB_BITS) - 1;
+			
+			if (shift < 0){
+				return b + 1;
+			}
+			return ((uint32_t)(STATS_SUB + (b & (STATS_SUB - 1))) << shift) +
+					((uint32_t)1 << shift);
+		}
+	}
+	return 0;
+}
+
+
+/***************************************************************
+*
+* print command statistics collected in the last period and
+* start a new period
+*
+****************************************************************/
+void cmd_stats_report(void){
+	cmd_stats_t st;
+	int64_t now, period;
+	
+	now = esp_timer_get_time();
+	portENTER_CRITICAL(&stats_lock);
+	st = cmd_stats;
+	memset(&cmd_stats, 0, sizeof(cmd_stats));
+	portEXIT_CRITICAL(&stats_lock);
+	period = now - stats_period_start;
+	stats_period_start = now;
+	if (period <= 0){
+		return;
+	}
+
+	printf("leds: %" PRId64 ".%02" PRId64 " cmd/s, p50 < %" PRIu32 " us, "
+			"p99 < %" PRIu32 " us, max %" PRId64 " us, rejected %" PRIu32 "/%" PRIu32
+			", notifications %" PRIu32 " (avg %" PRId64 " us)\n",
+			(int64_t)st.commands * 1000000 / period,
+			((int64_t)st.commands * 100000000 / period) % 100,
+			stats_percentile(&st, 50),
+			stats_percentile(&st, 99),
+			st.latency_max,
+			st.rejected, st.commands,
+			st.notifications,
+			(st.notifications > 0) ? (st.notify_time / st.notifications) : (int64_t)0);
+}
+#endif
+
+
+#ifdef CONFIG_LED_STREAM_ENABLE
+/***************************************************************
+*
+* start streaming mode, not possible while fade is running
+* inputs:
+*	- seq - sequence number of the first frame
+* output:
+*	- true if stream is started
+*
+****************************************************************/
+bool stream_start(uint16_t seq){
+	
+	led_lock();
+	if (fade_is_running == true){
+		led_unlock();
+		return false;
+	}
+	ledc_idle_exit();
+	stream_active = true;
+	led_unlock();
+	
+	portENTER_CRITICAL(&stream_lock);
+	memset(stream_buf, 0, sizeof(stream_buf));
+	memset(&stream_stats, 0, sizeof(stream_stats));
+	stream_next_seq = seq;
+	stream_buffered = 0;
+	stream_prefill = true;
+	stream_transit_prev = 0;
+	stream_duty[0] = channel_duty[LEDC_CHANNEL_A];
+	stream_duty[1] = channel_duty[LEDC_CHANNEL_B];
+	portEXIT_CRITICAL(&stream_lock);
+	
+	esp_timer_start_periodic(stream_tick, 1000000 / CONFIG_LED_STREAM_RATE_HZ);
+	
+	return true;
+}
+
+
+/***************************************************************
+*
+* no frames received for LED_STREAM_TIMEOUT, go back to the
+* light state set by properties
+*
+****************************************************************/
+void stream_stop(void){
+	
+	esp_timer_stop(stream_tick);
+	
+	led_lock();
+	stream_active = false;
+	channel_duty[LEDC_CHANNEL_A] = stream_duty[0];
+	channel_duty[LEDC_CHANNEL_B] = stream_duty[1];
+	light_transition();
+	if ((fade_is_running == false) && (channel_duty[LEDC_CHANNEL_A] == 0) &&
+		(channel_duty[LEDC_CHANNEL_B] == 0)){
+		ledc_idle_enter();
+	}
+	led_unlock();
+	
+	printf("leds stream: received %" PRIu32 ", played %" PRIu32 ", late %" PRIu32
+			", lost %" PRIu32 ", underruns %" PRIu32 ", jitter %" PRId64 " us\n",
+			stream_stats.received, stream_stats.played, stream_stats.late,
+			stream_stats.lost, stream_stats.underruns, stream_stats.jitter / 16);
+	
+	//notifications were suppressed, send all properties again at once,
+	//the LED task repeats it if sending fails
+	init_data_sent = false;
+	notify_post(NTF_INIT);
+	xTaskNotify(led_task, LED_EV_WAKE, eSetBits);
+}
+
+
+/***************************************************************
+*
+* put received frame into jitter buffer
+*
+****************************************************************/
+void stream_frame_rx(const stream_frame_t *frame, int64_t now){
+	stream_slot_t *slot;
+	int16_t ahead;
+	int64_t transit, d;
+	
+	portENTER_CRITICAL(&stream_lock);
+	stream_stats.received++;
+	
+	//interarrival jitter (RFC 3550), x16 fixed point
+	transit = now - (int64_t)frame -> timestamp * 1000;
+	if (stream_transit_prev != 0){
+		d = transit - stream_transit_prev;
+		if (d < 0){
+			d = -d;
+		}
+		stream_stats.jitter += d - (stream_stats.jitter + 8) / 16;
+	}
+	stream_transit_prev = transit;
+	
+	ahead = (int16_t)(frame -> seq - stream_next_seq);
+	if (ahead < 0){
+		//too late, already played or skipped
+		stream_stats.late++;
+	}
+	else{
+		if (ahead >= STREAM_BUF_LEN){
+			//too far ahead, start again from this frame
+			memset(stream_buf, 0, sizeof(stream_buf));
+			stream_buffered = 0;
+			stream_next_seq = frame -> seq;
+			stream_prefill = true;
+		}
+		slot = &stream_buf[frame -> seq % STREAM_BUF_LEN];
+		if (slot -> valid == false){
+			slot -> duty[0] = (frame -> duty[0] > LEDC_MAX_DUTY) ? LEDC_MAX_DUTY : frame -> duty[0];
+			slot -> duty[1] = (frame -> duty[1] > LEDC_MAX_DUTY) ? LEDC_MAX_DUTY : frame -> duty[1];
+			slot -> valid = true;
+			stream_buffered++;
+		}
+	}
+	portEXIT_CRITICAL(&stream_lock);
+}
+
+
+/***************************************************************
+*
+* periodic tick, play next frame from jitter buffer directly
+* on LEDC, missing frames are skipped, when buffer is empty the
+* last frame is kept and buffer is filled again
+*
+****************************************************************/
+void stream_tick_fun(void *arg){
+	stream_slot_t *slot;
+	uint32_t duty_a, duty_b;
+	bool play = false;
+	
+	portENTER_CRITICAL(&stream_lock);
+	if ((stream_prefill == true) && (stream_buffered >= CONFIG_LED_STREAM_DEPTH)){
+		stream_prefill = false;
+	}
+	if (stream_prefill == false){
+		slot = &stream_buf[stream_next_seq % STREAM_BUF_LEN];
+		while ((slot -> valid == false) && (stream_buffered > 0)){
+			//frame lost, skip it
+			stream_stats.lost++;
+			stream_next_seq++;
+			slot = &stream_buf[stream_next_seq % STREAM_BUF_LEN];
+		}
+		if (slot -> valid == true){
+			stream_duty[0] = slot -> duty[0];
+			stream_duty[1] = slot -> duty[1];
+			slot -> valid = false;
+			stream_buffered--;
+			stream_next_seq++;
+			stream_stats.played++;
+			play = true;
+		}
+		else{
+			stream_stats.underruns++;
+			stream_prefill = true;
+		}
+	}
+	duty_a = stream_duty[0];
+	duty_b = stream_duty[1];
+	portEXIT_CRITICAL(&stream_lock);
+#ifdef CONFIG_LED_LOAD_MANAGER
+	//frames are not slowed down, only limited
+	load_scale(&duty_a, &duty_b);
+#endif
+	
+	if (play == true){
+		ledc_set_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_A, duty_a);
+		ledc_update_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_A);
+		ledc_set_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_B, duty_b);
+		ledc_update_duty(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_B);
+	}
+}
+
+
+/***************************************************************
+*
+* stream task, receives frames over UDP
+*
+****************************************************************/
+void stream_fun(void *param){
+	struct sockaddr_in addr;
+	struct timeval tv;
+	stream_frame_t frame;
+	int sock, len;
+	
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(CONFIG_LED_STREAM_PORT);
+	if ((sock < 0) || (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)){
+		printf("leds stream: socket error\n");
+		led_lock();
+		stream_task = NULL;
+		led_unlock();
+		vTaskDelete(NULL);
+		return;
+	}
+	tv.tv_sec = CONFIG_LED_STREAM_TIMEOUT / 1000;
+	tv.tv_usec = (CONFIG_LED_STREAM_TIMEOUT % 1000) * 1000;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	
+	for (;;){
+		len = recv(sock, &frame, sizeof(frame), 0);
+		if (len == sizeof(frame)){
+			if (frame.magic != STREAM_MAGIC){
+				continue;
+			}
+			if ((stream_active == false) && (stream_start(frame.seq) == false)){
+				//fade is running, frame is dropped
+				continue;
+			}
+			stream_last_rx = esp_timer_get_time();
+			stream_frame_rx(&frame, stream_last_rx);
+		}
+		if ((stream_active == true) &&
+			((esp_timer_get_time() - stream_last_rx) >= (int64_t)CONFIG_LED_STREAM_TIMEOUT * 1000)){
+			stream_stop();
+		}
+	}
+}
+#endif
+
+
+#ifdef CONFIG_LED_BINARY_ENABLE
+/***************************************************************
+*
+* execute one binary request, the same state machine as for
+* Web Thing properties is used, subscribers are informed by the
+* notifier task, so the response is not delayed by slow clients
+* output:
+*	0 - value not changed, 1 - value changed, -1 - error
+*
+****************************************************************/
+int8_t bin_execute(const bin_req_t *req){
+	light_req_t lreq = {.mask = 0};
+	int16_t res;
+	
+	switch (req -> op){
+		case BIN_OP_GET:
+			return 0;
+			
+		case BIN_OP_ON:
+			if ((req -> value != 0) && (req -> value != 1)){
+				return -1;
+			}
+			lreq.mask = LIGHT_ON;
+			lreq.on = (req -> value == 1);
+			break;
+			
+		case BIN_OP_BRIGHTNESS:
+			lreq.mask = LIGHT_BRGH;
+			lreq.brightness = limit_brightness(req -> value);
+			break;
+			
+		case BIN_OP_CHANNEL:
+			if ((req -> value < 0) || (req -> value >= CH_NUMBER)){
+				return -1;
+			}
+			lreq.mask = LIGHT_CHANNEL;
+			lreq.channel = req -> value;
+			break;
+			
+		case BIN_OP_FADE:
+			lreq.mask = LIGHT_FADE;
+			lreq.fade_time = limit_fade_time(req -> value);
+			break;
+			
+		case BIN_OP_CCT:
+			lreq.mask = LIGHT_CCT;
+			lreq.color_temp = limit_color_temp(req -> value);
+			break;
+			
+		case BIN_OP_TIMER:
+			return (timer_start(req -> value) < 0) ? -1 : 1;
+			
+		default:
+			return -1;
+	}
+	
+	res = light_apply(&lreq);
+	if (res < 0){
+		return -1;
+	}
+	notify_post(res);
+	
+	return (res > 0) ? 1 : 0;
+}
+
+
+#ifdef CONFIG_LED_GROUP_SYNC
+/***************************************************************
+*
+* sync exchange is finished, clock offset and round trip delay
+* are computed from the times stored for the SYNC request,
+* offset of the sample with the shortest delay is used (the
+* least affected by network queues)
+*
+****************************************************************/
+void sync_result(const bin_time_t *res){
+	sync_pending_t *p = &sync_pending[res -> seq % SYNC_SAMPLES];
+	sync_sample_t *best;
+	int64_t delay;
 	
-	xTimerDelete(xTimer, 100); //delete timer
-	timer_is_running = false;
+	if ((p -> seq != res -> seq) || (p -> t2 == 0)){
+		return;
+	}
+	delay = (res -> t_b - res -> t_a) - (p -> t3 - p -> t2);
+	if (delay < 0){
+		return;
+	}
+	sync_samples[sync_sample_idx].offset = ((p -> t2 - res -> t_a) +
+											(p -> t3 - res -> t_b)) / 2;
+	sync_samples[sync_sample_idx].delay = delay;
+	sync_sample_idx = (sync_sample_idx + 1) % SYNC_SAMPLES;
+	p -> t2 = 0;
 	
-	if (state_changed == true){
-		inform_all_subscribers_prop(prop_on);
-		//copy current poropeties values
-		channel_t prev_cc = current_channel;
-		int32_t prev_fade_time = fade_time;
-		int32_t prev_brgh = brightness;
-		read_nvs_data(false);
-		//if any of the properties is changed inform clients
-		if (prev_cc != current_channel){
-			prop_channel -> value = channel_tab[current_channel];
-			inform_all_subscribers_prop(prop_channel);
-		}
-		if (prev_fade_time != fade_time){
-			inform_all_subscribers_prop(prop_fade_time);
-		}
-		if (prev_brgh != brightness){
-			inform_all_subscribers_prop(prop_brgh);
+	best = &sync_samples[0];
+	for (int i = 1; i < SYNC_SAMPLES; i++){
+		if ((sync_samples[i].delay != 0) &&
+			((best -> delay == 0) || (sync_samples[i].delay < best -> delay))){
+			best = &sync_samples[i];
 		}
 	}
+	sync_offset = best -> offset;
+	sync_valid = true;
 }
 
 
-/**********************************************************
- *
- * timer action
- * inputs:
- * 		- minutes of turn OFF in json, e.g.: "duration":10
- *
- * *******************************************************/
-int16_t timer_run(char *inputs){
-	int duration = 0, len;
-	char *p1, buff[6];
-	bool switched_on = false;
-
-	if (timer_is_running == true){
-		goto inputs_error;
-	}
+/***************************************************************
+*
+* group transition, start time is converted to local clock and
+* one shot timer is started, command for other group is ignored
+* output:
+*	1 - scheduled, 0 - not for this device, -1 - error
+*
+****************************************************************/
+int8_t group_schedule(const bin_group_t *cmd){
+	light_req_t req = {.mask = cmd -> mask};
+	int64_t delay;
 	
-	//get duration value
-	p1 = strstr(inputs, "duration");
-	if (p1 == NULL){
-		goto inputs_error;
-	}
-	p1 = strchr(p1, ':');
-	if (p1 == NULL){
-		goto inputs_error;
-	}
-	len = strlen(inputs) - (p1 + 1 - inputs);
-	if (len > 5){
-		goto inputs_error;
+	if ((cmd -> group != GROUP_ALL) && (cmd -> group != CONFIG_LED_GROUP_ID)){
+		return 0;
 	}
-	memset(buff, 0, 6);
-	memcpy(buff, p1 + 1, len);
-	duration = atoi(buff);
-	if ((duration > 600) || (duration == 0)){
-		goto inputs_error;
+	if ((sync_valid == false) || (cmd -> mask == 0) ||
+		((cmd -> mask & ~(LIGHT_ON | LIGHT_CHANNEL | LIGHT_BRGH |
+						  LIGHT_FADE | LIGHT_CCT)) != 0) ||
+		(cmd -> on > 1) || (cmd -> channel >= CH_NUMBER)){
+		return -1;
 	}
+	req.on = (cmd -> on == 1);
+	req.channel = cmd -> channel;
+	req.brightness = limit_brightness(cmd -> brightness);
+	req.fade_time = limit_fade_time(cmd -> fade_time);
+	req.color_temp = limit_color_temp(cmd -> color_temp);
 	
-	xSemaphoreTake(led_mux, portMAX_DELAY);
-	if (device_is_on == false){
-		device_is_on = true; //if device is OFF switch it ON now
-		switched_on = true;
-		int32_t brgh = brightness;
-	
-		//check current channel
-		switch (current_channel){
-			case CH_A:
-				fade_up_channel(LEDC_CHANNEL_A, brgh, fade_time);
-				break;
-				
-			case CH_B:
-				fade_up_channel(LEDC_CHANNEL_B, brgh, fade_time);
-				break;
-				
-			case CH_AB:
-			default:
-				//start channel A
-				fade_up_channel(LEDC_CHANNEL_A, brgh, fade_time);
-				//wait a bit
-				vTaskDelay(20 / portTICK_PERIOD_MS);
-				//start channel B
-				fade_up_channel(LEDC_CHANNEL_B, brgh, fade_time);
-		}
-		//fade_counter = 0;
-	}
-	//start timer
-	timer = xTimerCreate("timer",
-						pdMS_TO_TICKS(duration * 60 * 1000),
-						pdFALSE,
-						pdFALSE,
-						timer_fun);
-
-	xSemaphoreGive(led_mux);
+	esp_timer_stop(group_timer);
+	led_lock();
+	group_req = req;
+	led_unlock();
 	
-	if (xTimerStart(timer, 5) == pdFAIL){
-		printf("timer failed\n");
+	delay = cmd -> start + sync_offset - esp_timer_get_time();
+	if (delay <= 0){
+		//too late, start immediately
+		printf("leds group: start %" PRId64 " us late\n", -delay);
+		xTaskNotify(led_task, LED_EV_GROUP, eSetBits);
 	}
 	else{
-		timer_is_running = true;
-		if (switched_on == true){
-			inform_all_subscribers_prop(prop_on);
-		}
+		esp_timer_start_once(group_timer, delay);
 	}
+	return 1;
+}
 
-	return 0;
 
-	inputs_error:
-		printf("timer ERROR\n");
-	return -1;
+/***************************************************************
+*
+* start time of group transition, LED task applies it
+*
+****************************************************************/
+void group_timer_fun(void *arg){
+	xTaskNotify(led_task, LED_EV_GROUP, eSetBits);
 }
 
 
-/*******************************************************************
+/***************************************************************
 *
-* set channel, called after http PUT method
-* output:
-*	0 - value is ok, but not changed (the same as previous one)
-*	1 - value is changed, subscribers will be informed
-*  -1 - error
+* apply scheduled group transition, running fade is replaced
+* (all devices of the group must start the same transition)
 *
-*******************************************************************/
-int16_t set_channel(char *name, char *new_value_str){
-	bool channel_is_changed = false;
-	char *buff = NULL;
-	int16_t result = 0;
+****************************************************************/
+void group_apply(void){
+	light_req_t req;
+	int16_t changed;
 	
-	//in websocket quotation mark is not removed
-	//(in http should be the same but is not)
-	buff = malloc(strlen(new_value_str));
-	if (new_value_str[0] == '"'){
-		memset(buff, 0, strlen(new_value_str));
-		char *ptr = strchr(new_value_str + 1, '"');
-		int len = ptr - new_value_str - 1;
-		memcpy(buff, new_value_str + 1, len);
+	led_lock();
+	req = group_req;
+	led_unlock();
+	
+	changed = light_force(&req);
+	if (changed > 0){
+		notify_post(changed);
 	}
-	else{
-		strcpy(buff, new_value_str);
-	}
-	
-	//set channel
-	if (prop_channel -> enum_list != NULL){
-		int i = 0;
-		enum_item_t *enum_item = prop_channel -> enum_list;
-		while (enum_item != NULL){
-			if (strcmp(buff, enum_item -> value.str_addr) == 0){
-				prop_channel -> value = enum_item -> value.str_addr;
-				if (i != current_channel){
-					prev_current_channel = current_channel;
-					current_channel = i;
-					channel_is_changed = true;
-					result = 1;
-				}
-				else{
-					channel_is_changed = false;
-				}
+}
+#endif
+
+
+/***************************************************************
+*
+* binary control task, fixed layout requests over UDP, repeated
+* request (the same client and sequence number) is not executed
+* again, the previous response is sent
+*
+****************************************************************/
+void bin_fun(void *param){
+	struct sockaddr_in addr, client;
+	socklen_t addr_len;
+	union {
+		bin_req_t req;
+#ifdef CONFIG_LED_GROUP_SYNC
+		bin_time_t time;
+		bin_group_t group;
+#endif
+	} msg;
+	bin_req_t *req = &msg.req;
+	bin_resp_t resp;
+	bin_client_t *cl;
+	int sock, len, next_client = 0;
+	
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(CONFIG_LED_BINARY_PORT);
+	if ((sock < 0) || (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)){
+		printf("leds binary: socket error\n");
+		led_lock();
+		bin_task = NULL;
+		led_unlock();
+		vTaskDelete(NULL);
+		return;
+	}
+	
+	for (;;){
+		addr_len = sizeof(client);
+		len = recvfrom(sock, &msg, sizeof(msg), 0,
+						(struct sockaddr *)&client, &addr_len);
+		if ((len < (int)sizeof(bin_req_t)) || (req -> magic != BIN_MAGIC)){
+			continue;
+		}
+#ifdef CONFIG_LED_GROUP_SYNC
+		if ((req -> op == BIN_OP_SYNC) && (len == sizeof(bin_time_t))){
+			//receive time is taken as soon as possible
+			sync_pending_t *p = &sync_pending[msg.time.seq % SYNC_SAMPLES];
+			
+			p -> seq = msg.time.seq;
+			p -> t2 = esp_timer_get_time();
+			msg.time.t_a = p -> t2;
+			msg.time.t_b = p -> t3 = esp_timer_get_time();
+			sendto(sock, &msg.time, sizeof(bin_time_t), 0,
+					(struct sockaddr *)&client, addr_len);
+			continue;
+		}
+		if ((req -> op == BIN_OP_SYNC_RESULT) && (len == sizeof(bin_time_t))){
+			sync_result(&msg.time);
+			continue;
+		}
+		if ((req -> op == BIN_OP_GROUP) && (len != sizeof(bin_group_t))){
+			continue;
+		}
+		if ((req -> op != BIN_OP_GROUP) && (len != sizeof(bin_req_t))){
+			continue;
+		}
+		if ((req -> op == BIN_OP_GROUP) && (msg.group.group != GROUP_ALL) &&
+			(msg.group.group != CONFIG_LED_GROUP_ID)){
+			//broadcast for other group, the sender does not take
+			//a client slot (retransmission cache of other clients)
+			continue;
+		}
+#else
+		if (len != sizeof(bin_req_t)){
+			continue;
+		}
+#endif
+		
+		//find client
+		cl = NULL;
+		for (int i = 0; i < BIN_CLIENTS; i++){
+			if ((bin_clients[i].addr == client.sin_addr.s_addr) &&
+				(bin_clients[i].port == client.sin_port)){
+				cl = &bin_clients[i];
 				break;
 			}
-			else{
-				enum_item = enum_item -> next;
-				i++;
+		}
+		if ((cl != NULL) && (cl -> resp.seq == req -> seq) && (cl -> resp.op == req -> op)){
+			//retransmitted request, already executed
+			sendto(sock, &cl -> resp, sizeof(bin_resp_t), 0,
+					(struct sockaddr *)&client, addr_len);
+			continue;
+		}
+		if (cl == NULL){
+			cl = &bin_clients[next_client];
+			next_client = (next_client + 1) % BIN_CLIENTS;
+			cl -> addr = client.sin_addr.s_addr;
+			cl -> port = client.sin_port;
+		}
+		
+		memset(&resp, 0, sizeof(resp));
+		resp.magic = BIN_MAGIC;
+		resp.op = req -> op;
+		resp.seq = req -> seq;
+#ifdef CONFIG_LED_GROUP_SYNC
+		if (req -> op == BIN_OP_GROUP){
+			resp.status = group_schedule(&msg.group);
+			if (resp.status == 0){
+				//other group, no response
+				continue;
 			}
 		}
+		else
+#endif
+		{
+#ifdef CONFIG_LED_CMD_STATS
+			int64_t start = esp_timer_get_time();
+			resp.status = bin_execute(req);
+			cmd_stats_add(start, resp.status);
+#else
+			resp.status = bin_execute(req);
+#endif
+		}
+		
+		led_lock();
+		resp.on = device_is_on;
+		resp.channel = current_channel;
+		resp.brightness = brightness;
+		resp.fade_time = fade_time;
+		resp.color_temp = color_temp;
+		led_unlock();
+		
+		cl -> resp = resp;
+		sendto(sock, &resp, sizeof(resp), 0, (struct sockaddr *)&client, addr_len);
 	}
+}
+#endif
 
-	//if channel is changed when device is ON then switch OFF previous channel
-	//and switch ON new channel
-	if ((channel_is_changed == true) && (device_is_on == true) && 
-		(fade_is_running == false)){
-		switch (prev_current_channel){
-			case CH_A:
-				if (current_channel == CH_B){
-					fade_up_channel(LEDC_CHANNEL_A, 0, fade_time);
-					vTaskDelay(20 / portTICK_PERIOD_MS);
-					fade_up_channel(LEDC_CHANNEL_B, brightness, fade_time);
-				}
-				else{
-					fade_up_channel(LEDC_CHANNEL_B, brightness, fade_time);
-				}
-				break;
-				
-			case CH_B:
-				if (current_channel == CH_A){
-					fade_up_channel(LEDC_CHANNEL_B, 0, fade_time);
-					vTaskDelay(20 / portTICK_PERIOD_MS);
-					fade_up_channel(LEDC_CHANNEL_A, brightness, fade_time);
-				}
-				else{
-					fade_up_channel(LEDC_CHANNEL_A, brightness, fade_time);
-				}
-				break;
-				
-			case CH_AB:
-			default:
-				if (current_channel == CH_A){
-					fade_up_channel(LEDC_CHANNEL_B, 0, fade_time);
-				}
-				else{
-					fade_up_channel(LEDC_CHANNEL_A, 0, fade_time);
-				}									
-		}
+
+/***************************************************************
+*
+* add ON time since last accumulation, time is measured with
+* monotonic esp_timer so wall clock steps do not change it,
+* led_mux must be taken
+*
+****************************************************************/
+void on_time_accumulate(int64_t now){
+	if (device_is_on == true){
+		on_time_us += now - on_time_mono;
+	}
+	on_time_mono = now;
+}
+
+
+/***************************************************************
+*
+* place the next midnight on the monotonic clock, wall clock is
+* used only here, output:
+*	- true if wall clock is set and the deadline is known
+*
+****************************************************************/
+bool day_end_update(int64_t now){
+	struct tm timeinfo;
+	time_t current_time;
+
+	time(&current_time);
+	localtime_r(&current_time, &timeinfo);
+	if (timeinfo.tm_year <= (2018 - 1900)) {
+		//time is not set yet
+		day_end_mono = 0;
+		return false;
 	}
-	free(buff);
+	timeinfo.tm_mday++;
+	timeinfo.tm_hour = 0;
+	timeinfo.tm_min = 0;
+	timeinfo.tm_sec = 0;
+	timeinfo.tm_isdst = -1;
+	day_end_wall = mktime(&timeinfo);
+	day_end_mono = now + (int64_t)(day_end_wall - current_time) * 1000000;
 	
-	return result;
+	return true;
 }
 
 
-/*********************************************************************
- *
- * main task
- *
- * ******************************************************************/
-void leds_fun(void *param){
+/***************************************************************
+*
+* check if day is finished, wall clock is compared with the
+* deadline to detect steps (e.g. first SNTP synchronization),
+* led_mux must be taken
+* output:
+*	- true if midnight passed
+*
+****************************************************************/
+bool day_end_check(int64_t now){
+	time_t current_time, expected;
 	
-	TickType_t last_wake_time = xTaskGetTickCount();
-	for (;;){
-		last_wake_time = xTaskGetTickCount();
-		
-		update_on_time(false);
-		
-		if (init_data_sent == false){
-			int8_t s1 = inform_all_subscribers_prop(prop_channel);
-			int8_t s2 = inform_all_subscribers_prop(prop_on);
-			int8_t s3 = inform_all_subscribers_prop(prop_daily_on_time);
-			int8_t s4 = inform_all_subscribers_prop(prop_brgh);
-			int8_t s5 = inform_all_subscribers_prop(prop_fade_time);
-			if ((s1 == 0) && (s2 == 0) && (s3 == 0) && (s4 == 0) && (s5 == 0)){
-				init_data_sent = true;
-			}
-		}
+	if (day_end_mono == 0){
+		//midnight not known yet
+		day_end_update(now);
+		return false;
+	}
 	
-		vTaskDelayUntil(&last_wake_time, APP_PERIOD / portTICK_PERIOD_MS);
+	time(&current_time);
+	if (current_time >= day_end_wall){
+		//midnight passed, also if wall clock stepped over it
+		day_end_update(now);
+		return true;
 	}
+	expected = day_end_wall - (time_t)((day_end_mono - now) / 1000000);
+	if ((current_time - expected > DAY_END_MAX_STEP) ||
+		(expected - current_time > DAY_END_MAX_STEP)){
+		//wall clock stepped, place midnight again
+		day_end_update(now);
+	}
+	
+	return false;
 }
 
 
@@ -652,53 +2770,76 @@ void leds_fun(void *param){
 *
 ****************************************************************/
 void update_on_time(bool reset){
-	struct tm timeinfo;
-	int delta_t = 0, prev_minutes = 0, new_minutes = 0;
-	time_t current_time, prev_time;
+	int prev_minutes;
+	int64_t now;
 	bool send_data = false;
 
-	prev_time = on_time_last_update;
-	time(&current_time);
-	localtime_r(&current_time, &timeinfo);
-	if (timeinfo.tm_year > (2018 - 1900)) {
-		//time is correct
-		xSemaphoreTake(led_mux, portMAX_DELAY);
-		if (device_is_on == true){
-			prev_minutes = daily_on_time_min;
-			new_minutes = prev_minutes;
-			delta_t = current_time - prev_time;
-			if (delta_t > 0){
-				daily_on_time_sec += delta_t;
-				daily_on_time_min = daily_on_time_sec / 60;
-				new_minutes = daily_on_time_min;
-			}	
-		}
-		on_time_last_update = current_time;
-		xSemaphoreGive(led_mux);
-		
-		if (new_minutes != prev_minutes){
-			send_data = true;
-		}
-		
-		if (reset == true){
-			xSemaphoreTake(led_mux, portMAX_DELAY);
-			daily_on_time_sec = 0;
-			daily_on_time_min = 0;
-			xSemaphoreGive(led_mux);
-			send_data = true;
+	led_lock();
+	now = esp_timer_get_time();
+	on_time_accumulate(now);
+	if (day_end_check(now) == true){
+		reset = true;
+	}
+	if (reset == true){
+		on_time_us = 0;
+		send_data = true;
+	}
+	prev_minutes = daily_on_time_min;
+	daily_on_time_min = on_time_us / 60000000;
+	if (daily_on_time_min != prev_minutes){
+		send_data = true;
+	}
+	led_unlock();
+	
+	if (send_data == true){
+		notify_post(NTF_DAILY_ON);
+	}
+}
+
+
+/***************************************************************
+*
+* time to the next ON time event: minute change when device
+* is ON, midnight or wall clock check [ticks]
+*
+****************************************************************/
+TickType_t on_time_wait(void){
+	int64_t now, wait_us, to_minute;
+	
+	led_lock();
+	now = esp_timer_get_time();
+	if (day_end_mono == 0){
+		//wall clock not set, check it periodically
+		wait_us = (int64_t)APP_PERIOD * 1000;
+	}
+	else{
+		//light may be OFF and idle until midnight, a forward step of
+		//the wall clock would make the reset late
+		wait_us = day_end_mono - now;
+		if (wait_us > (int64_t)DAY_END_RECHECK * 1000000){
+			wait_us = (int64_t)DAY_END_RECHECK * 1000000;
 		}
-		
-		if (send_data == true){
-			inform_all_subscribers_prop(prop_daily_on_time);
+	}
+	if (device_is_on == true){
+		to_minute = 60000000 - (on_time_us + now - on_time_mono) % 60000000;
+		if (to_minute < wait_us){
+			wait_us = to_minute;
 		}
-    }
+	}
+	led_unlock();
+	
+	if (wait_us < 0){
+		wait_us = 0;
+	}
+	
+	return (wait_us / 1000) / portTICK_PERIOD_MS + 1;
 }
 
 
 /*************************************************************
 *
-* at the beginning of the day reset minuts and seconds counters
-* and inform subscribers if necessary
+* reset ON time counter and inform subscribers, midnight is
+* detected by the module itself, this reset is optional
 *
 **************************************************************/
 void daily_on_time_reset(void){
@@ -755,6 +2896,146 @@ void init_ledc(void){
     
     // Initialize fade service.
     ledc_fade_func_install(ESP_INTR_FLAG_IRAM);
+    
+#if defined(CONFIG_LED_IDLE_POWER_SAVE) && defined(CONFIG_PM_ENABLE)
+	esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "leds_apb", &pm_apb_lock);
+	esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "leds_sleep", &pm_sleep_lock);
+	//locks are held while LEDC is active
+	esp_pm_lock_acquire(pm_apb_lock);
+	esp_pm_lock_acquire(pm_sleep_lock);
+#endif
+	//both channels are OFF after start
+	power_state_since = esp_timer_get_time();
+	ledc_idle_enter();
+}
+
+
+#ifdef CONFIG_LED_CMD_STATS
+//property and action handlers wrapped with time measurement
+#define CMD_STATS_SETTER(fun) \
+	static int16_t fun##_stats(char *name, char *new_value_str){ \
+		int64_t start = esp_timer_get_time(); \
+		int16_t res = fun(name, new_value_str); \
+		cmd_stats_add(start, res); \
+		return res; \
+	}
+
+CMD_STATS_SETTER(set_on_off)
+CMD_STATS_SETTER(set_channel)
+CMD_STATS_SETTER(brightness_set)
+CMD_STATS_SETTER(fade_time_set)
+CMD_STATS_SETTER(color_temp_set)
+
+#define CMD_STATS_ACTION(fun) \
+	static int16_t fun##_stats(char *inputs){ \
+		int64_t start = esp_timer_get_time(); \
+		int16_t res = fun(inputs); \
+		cmd_stats_add(start, res); \
+		return res; \
+	}
+
+CMD_STATS_ACTION(timer_run)
+CMD_STATS_ACTION(apply_run)
+#define CMD_HANDLER(fun) fun##_stats
+#else
+#define CMD_HANDLER(fun) fun
+#endif
+
+
+/*****************************************************************
+ *
+ * descriptors of all properties and actions
+ *
+ * ****************************************************************/
+static const prop_desc_t prop_desc[PROP_NUMBER] = {
+	{&prop_on, on_prop_id, on_prop_title, on_prop_disc, on_prop_attype_str,
+		NULL, VAL_BOOLEAN, &device_is_on, false, false, 0, 0,
+		CMD_HANDLER(set_on_off)},
+	{&prop_channel, channel_prop_id, channel_prop_title, channel_prop_disc,
+		channel_prop_attype_str, NULL, VAL_STRING, NULL, false, false, 0, 0,
+		CMD_HANDLER(set_channel)},
+	{&prop_daily_on_time, daily_on_prop_id, daily_on_prop_title,
+		daily_on_prop_disc, daily_on_prop_attype_str, daily_on_prop_unit,
+		VAL_INTEGER, &daily_on_time_min, true, true, 0, 1440, NULL},
+	{&prop_brgh, brgh_id, brgh_prop_title, brgh_prop_disc, brgh_prop_attype_str,
+		brgh_prop_unit, VAL_INTEGER, &brightness, false, true, 0, 100,
+		CMD_HANDLER(brightness_set)},
+	{&prop_fade_time, fade_time_id, fade_time_prop_title, fade_time_prop_disc,
+		fade_time_prop_attype_str, fade_time_prop_unit, VAL_INTEGER, &fade_time,
+		false, true, 100, 10000, CMD_HANDLER(fade_time_set)},
+	{&prop_color_temp, color_temp_id, color_temp_prop_title, color_temp_prop_disc,
+		color_temp_prop_attype_str, color_temp_prop_unit, VAL_INTEGER, &color_temp,
+		false, true, CCT_WARM, CCT_COOL, CMD_HANDLER(color_temp_set)},
+	{&prop_level_a, level_a_id, level_a_prop_title, level_a_prop_disc,
+		level_prop_attype_str, brgh_prop_unit, VAL_INTEGER, &level_a, true, true,
+		0, 100, NULL},
+	{&prop_level_b, level_b_id, level_b_prop_title, level_b_prop_disc,
+		level_prop_attype_str, brgh_prop_unit, VAL_INTEGER, &level_b, true, true,
+		0, 100, NULL},
+#ifdef CONFIG_LED_DIAGNOSTICS
+	{&prop_diag, diag_id, diag_prop_title, diag_prop_disc, NULL, NULL,
+		VAL_STRING, diagnostics, true, false, 0, 0, NULL},
+#endif
+};
+
+static const input_desc_t timer_inputs[] = {
+	{timer_prop_dur_id, VAL_INTEGER, true, true, 1, 600, timer_duration_unit, false},
+};
+
+static const input_desc_t apply_inputs[] = {
+	{on_prop_id, VAL_BOOLEAN, false, false, 0, 0, NULL, false},
+	{channel_prop_id, VAL_STRING, false, false, 0, 0, NULL, true},
+	{brgh_id, VAL_INTEGER, false, true, 0, 100, brgh_prop_unit, false},
+	{fade_time_id, VAL_INTEGER, false, true, 100, 10000, fade_time_prop_unit, false},
+	{color_temp_id, VAL_INTEGER, false, true, CCT_WARM, CCT_COOL,
+		color_temp_prop_unit, false},
+};
+
+static const action_desc_t action_desc[ACTION_NUMBER] = {
+	{&timer_action, timer_id, timer_title, timer_desc, timer_input_attype_str,
+		CMD_HANDLER(timer_run), timer_inputs,
+		sizeof(timer_inputs) / sizeof(input_desc_t)},
+	{&apply_action, apply_id, apply_title, apply_desc, NULL,
+		CMD_HANDLER(apply_run), apply_inputs,
+		sizeof(apply_inputs) / sizeof(input_desc_t)},
+};
+
+
+/*****************************************************************
+ *
+ * thing, property and action objects, in static allocation mode
+ * taken from buffers reserved at compile time
+ *
+ * ****************************************************************/
+static thing_t *new_thing(void){
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+	memset(&leds_buff, 0, sizeof(leds_buff));
+	return &leds_buff;
+#else
+	return thing_init();
+#endif
+}
+
+static property_t *new_property(void){
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+	property_t *prop = &prop_buff[prop_buff_used++];
+	
+	memset(prop, 0, sizeof(property_t));
+	return prop;
+#else
+	return property_init(NULL, NULL);
+#endif
+}
+
+static action_t *new_action(void){
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+	action_t *action = &action_buff[action_buff_used++];
+	
+	memset(action, 0, sizeof(action_t));
+	return action;
+#else
+	return action_init();
+#endif
 }
 
 
@@ -764,148 +3045,178 @@ void init_ledc(void){
  *
  * ****************************************************************/
 thing_t *init_led_2_channels(void){
+	uint32_t free_heap = esp_get_free_heap_size();
 
-	read_nvs_data(true);
+	read_nvs_data();
 	prev_current_channel = current_channel;
+	cct_table_init();
 	
 	init_ledc();
 	
 	//start thing
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+	led_mux = xSemaphoreCreateMutexStatic(&led_mux_buff);
+	fade_timer = xTimerCreateStatic("fade_timer", 1, pdFALSE, NULL,
+									fade_timer_fun, &fade_timer_buff);
+	timer = xTimerCreateStatic("timer", 1, pdFALSE, NULL,
+								timer_fun, &timer_buff);
+#else
 	led_mux = xSemaphoreCreateMutex();
+	fade_timer = xTimerCreate("fade_timer", 1, pdFALSE, NULL, fade_timer_fun);
+	timer = xTimerCreate("timer", 1, pdFALSE, NULL, timer_fun);
+#endif
 	//create thing 1, thermostat ---------------------------------
-	leds = thing_init();
+	leds = new_thing();
 
-	leds -> id = leds_id_str;
+	leds -> id = (char *)leds_id_str;
 	leds -> at_context = things_context;
-	leds -> model_len = 2300;
+#ifdef CONFIG_LED_DIAGNOSTICS
+	leds -> model_len = 5000;
+#else
+	leds -> model_len = 4600;
+#endif
 	//set @type
-	leds_type.at_type = leds_attype_str;
+	leds_type.at_type = (char *)leds_attype_str;
 	leds_type.next = NULL;
 	set_thing_type(leds, &leds_type);
-	leds -> description = leds_disc;
-	
-	//property: ON/OFF
-	prop_on = property_init(NULL, NULL);
-	prop_on -> id = "on";
-	prop_on -> description = "ON/OFF";
-	on_prop_type.at_type = "OnOffProperty";
-	on_prop_type.next = NULL;
-	prop_on -> at_type = &on_prop_type;
-	prop_on -> type = VAL_BOOLEAN;
-	prop_on -> value = &device_is_on;
-	prop_on -> title = "ON/OFF";
-	prop_on -> read_only = false;
-	prop_on -> set = set_on_off;
-	prop_on -> mux = led_mux;
-	add_property(leds, prop_on); //add property to thing
-	
-	//create "channel" property ------------------------------------
+	leds -> description = (char *)leds_disc;
+	
+	//list of channels
+	for (int i = 0; i < CH_NUMBER; i++){
+		channel_enum[i].value.str_addr = (char *)channel_tab[i];
+		channel_enum[i].next = (i < CH_NUMBER - 1) ? &channel_enum[i + 1] : NULL;
+	}
+	
+	//create properties
+	for (int i = 0; i < PROP_NUMBER; i++){
+		const prop_desc_t *d = &prop_desc[i];
+		property_t *prop = new_property();
+		
+		prop -> id = (char *)d -> id;
+		prop -> title = (char *)d -> title;
+		prop -> description = (char *)d -> description;
+		if (d -> at_type != NULL){
+			prop_types[i].at_type = (char *)d -> at_type;
+			prop_types[i].next = NULL;
+			prop -> at_type = &prop_types[i];
+		}
+		prop -> unit = (char *)d -> unit;
+		prop -> type = d -> type;
+		prop -> value = d -> value;
+		if (d -> has_range == true){
+			prop -> min_value.int_val = d -> min;
+			prop -> max_value.int_val = d -> max;
+		}
+		prop -> read_only = d -> read_only;
+		prop -> enum_prop = false;
+		prop -> set = d -> set;
+		prop -> mux = led_mux;
+		*(d -> prop) = prop;
+	}
 	//pop-up list to choose channel
-	prop_channel = property_init(NULL, NULL);
-	prop_channel -> id = channel_prop_id;
-	prop_channel -> description = channel_prop_disc;
-	channel_prop_type.at_type = channel_prop_attype_str;
-	channel_prop_type.next = NULL;
-	prop_channel -> at_type = &channel_prop_type;
-	prop_channel -> type = VAL_STRING;
-	prop_channel -> value = channel_tab[current_channel];
-	prop_channel -> title = channel_prop_title;
-	prop_channel -> read_only = false;
+	prop_channel -> value = (char *)channel_tab[current_channel];
 	prop_channel -> enum_prop = true;
-	prop_channel -> enum_list = &enum_ch_A;
-	enum_ch_A.value.str_addr = channel_tab[0];
-	enum_ch_A.next = &enum_ch_B;
-	enum_ch_B.value.str_addr = channel_tab[1];
-	enum_ch_B.next = &enum_ch_AB;
-	enum_ch_AB.value.str_addr = channel_tab[2];
-	enum_ch_AB.next = NULL;
-	prop_channel -> set = &set_channel;
-	prop_channel -> mux = led_mux;
-
-	add_property(leds, prop_channel); //add property to thing	
-	
-	//create "daily on time" property -------------------------------------------
-	prop_daily_on_time = property_init(NULL, NULL);
-	prop_daily_on_time -> id = daily_on_prop_id;
-	prop_daily_on_time -> description = daily_on_prop_disc;
-	daily_on_prop_type.at_type = daily_on_prop_attype_str;
-	daily_on_prop_type.next = NULL;
-	prop_daily_on_time -> at_type = &daily_on_prop_type;
-	prop_daily_on_time -> type = VAL_INTEGER;
-	prop_daily_on_time -> value = &daily_on_time_min;
-	prop_daily_on_time -> unit = daily_on_prop_unit;
-	prop_daily_on_time -> max_value.int_val = 1440;
-	prop_daily_on_time -> min_value.int_val = 0;
-	prop_daily_on_time -> title = daily_on_prop_title;
-	prop_daily_on_time -> read_only = true;
-	prop_daily_on_time -> enum_prop = false;
-	prop_daily_on_time -> set = NULL;
-	prop_daily_on_time -> mux = led_mux;
-	
-	add_property(leds, prop_daily_on_time); //add property to thing
-	
-	//property: brightness
-	prop_brgh = property_init(NULL, NULL);
-	prop_brgh -> id = brgh_id;
-	prop_brgh -> description = brgh_prop_disc;
-	brgh_prop_type.at_type = brgh_prop_attype_str;
-	brgh_prop_type.next = NULL;
-	prop_brgh -> at_type = &brgh_prop_type;
-	prop_brgh -> type = VAL_INTEGER;
-	prop_brgh -> value = &brightness;
-	prop_brgh -> max_value.int_val = 100;
-	prop_brgh -> min_value.int_val = 0;
-	prop_brgh -> unit = brgh_prop_unit;
-	prop_brgh -> title = brgh_prop_title;
-	prop_brgh -> read_only = false;
-	prop_brgh -> set = brightness_set;
-	prop_brgh -> mux = led_mux;
-	add_property(leds, prop_brgh);
-	
-	//property: fade_time
-	prop_fade_time = property_init(NULL, NULL);
-	prop_fade_time -> id = fade_time_id;
-	prop_fade_time -> description = fade_time_prop_disc;
-	fade_time_prop_type.at_type = fade_time_prop_attype_str;
-	fade_time_prop_type.next = NULL;
-	prop_fade_time -> at_type = &fade_time_prop_type;
-	prop_fade_time -> type = VAL_INTEGER;
-	prop_fade_time -> value = &fade_time;
-	prop_fade_time -> max_value.int_val = 10000;
-	prop_fade_time -> min_value.int_val = 100;
-	prop_fade_time -> unit = fade_time_prop_unit;
-	prop_fade_time -> title = fade_time_prop_title;
-	prop_fade_time -> read_only = false;
-	prop_fade_time -> set = fade_time_set;
-	prop_fade_time -> mux = led_mux;
-	add_property(leds, prop_fade_time);
-	
-	//create action "timer", turn on lights (device) for specified minutes
-	int_float_u timer_min, timer_max; //minutes
-	timer_min.int_val = 1; //minutes
-	timer_max.int_val = 600;
-	
-	timer_action = action_init();
-	timer_action -> id = timer_id;
-	timer_action -> title = timer_title;
-	timer_action -> description = timer_desc;
-	timer_action -> run = timer_run;
-	timer_input_attype.at_type = timer_input_attype_str;
-	timer_input_attype.next = NULL;
-	timer_action -> input_at_type = &timer_input_attype;
-	timer_duration = action_input_prop_init("duration",
-											VAL_INTEGER,
-											true,
-											&timer_min,
-											&timer_max,
-											"minutes",
-											false,
-											NULL);
-	add_action_input_prop(timer_action, timer_duration);
-	add_action(leds, timer_action);
-
-	//start thread	
-	xTaskCreate(&leds_fun, "leds", configMINIMAL_STACK_SIZE * 4, NULL, 5, &led_task);
+	prop_channel -> enum_list = &channel_enum[0];
+	
+	for (int i = 0; i < PROP_NUMBER; i++){
+		add_property(leds, *(prop_desc[i].prop)); //add property to thing
+	}
+	
+	//create actions
+	for (int i = 0; i < ACTION_NUMBER; i++){
+		const action_desc_t *d = &action_desc[i];
+		action_t *action = new_action();
+		
+		action -> id = (char *)d -> id;
+		action -> title = (char *)d -> title;
+		action -> description = (char *)d -> description;
+		action -> run = d -> run;
+		if (d -> input_at_type != NULL){
+			action_types[i].at_type = (char *)d -> input_at_type;
+			action_types[i].next = NULL;
+			action -> input_at_type = &action_types[i];
+		}
+		for (int j = 0; j < d -> inputs_number; j++){
+			const input_desc_t *in = &d -> inputs[j];
+			int_float_u in_min, in_max;
+			
+			in_min.int_val = in -> min;
+			in_max.int_val = in -> max;
+			add_action_input_prop(action,
+						action_input_prop_init((char *)in -> id,
+											in -> type,
+											in -> required,
+											(in -> has_range) ? &in_min : NULL,
+											(in -> has_range) ? &in_max : NULL,
+											(char *)in -> unit,
+											in -> channel_enum,
+											(in -> channel_enum) ? &channel_enum[0] : NULL));
+		}
+		add_action(leds, action);
+		*(d -> action) = action;
+	}
+
+	//start threads, notifier first, the LED task hands messages over to it
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+	notify_task = xTaskCreateStatic(&notify_fun, "leds_notify", NOTIFY_TASK_STACK,
+									NULL, 5, notify_task_stack, &notify_task_buff);
+#else
+	xTaskCreate(&notify_fun, "leds_notify", NOTIFY_TASK_STACK, NULL, 5, &notify_task);
+#endif
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+	led_task = xTaskCreateStatic(&leds_fun, "leds", LED_TASK_STACK, NULL,
+								LED_TASK_PRIORITY, led_task_stack, &led_task_buff);
+#else
+	xTaskCreate(&leds_fun, "leds", LED_TASK_STACK, NULL, LED_TASK_PRIORITY, &led_task);
+#endif
+#ifdef CONFIG_LED_SWITCH_ENABLE
+	switch_init();
+#endif
+	
+#ifdef CONFIG_LED_STREAM_ENABLE
+	esp_timer_create_args_t tick_args = {
+		.callback = stream_tick_fun,
+		.arg = NULL,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "leds_stream"
+	};
+	esp_timer_create(&tick_args, &stream_tick);
+	//the handle is set before the task can clear it on socket error
+	led_lock();
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+	stream_task = xTaskCreateStatic(&stream_fun, "leds_stream", STREAM_TASK_STACK,
+									NULL, 5, stream_task_stack, &stream_task_buff);
+#else
+	xTaskCreate(&stream_fun, "leds_stream", STREAM_TASK_STACK, NULL, 5, &stream_task);
+#endif
+	led_unlock();
+#endif
+	
+#ifdef CONFIG_LED_BINARY_ENABLE
+#ifdef CONFIG_LED_GROUP_SYNC
+	esp_timer_create_args_t group_args = {
+		.callback = group_timer_fun,
+		.arg = NULL,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "leds_group"
+	};
+	esp_timer_create(&group_args, &group_timer);
+#endif
+	led_lock();
+#ifdef CONFIG_LED_STATIC_ALLOCATION
+	bin_task = xTaskCreateStatic(&bin_fun, "leds_bin", BIN_TASK_STACK, NULL, 5,
+								bin_task_stack, &bin_task_buff);
+#else
+	xTaskCreate(&bin_fun, "leds_bin", BIN_TASK_STACK, NULL, 5, &bin_task);
+#endif
+	led_unlock();
+#endif
+	
+	//heap audit, after this point the code of this component (commands,
+	//fades, timers, notifier task) does not use heap, checked on host by
+	//test_alloc; the server may allocate when it builds messages
+	printf("leds: %u bytes of heap used by initialization\n",
+			(unsigned)(free_heap - esp_get_free_heap_size()));
 
 	return leds;
 }
@@ -913,20 +3224,24 @@ thing_t *init_led_2_channels(void){
 
 /****************************************************************
  *
- * read dual light data written in NVS memory:
+ * read dual light data written in NVS memory into RAM shadow
+ * and current values, called once at start:
  *  - current channel
+ *  - brightness
+ *  - fade time
+ *  - color temperature
  *
  * **************************************************************/
-void read_nvs_data(bool read_default){
+void read_nvs_data(void){
 	esp_err_t err;
 	nvs_handle storage = 0;
 
-	if (read_default == true){
-		//default values
-		current_channel = CH_AB;
-		brightness = 20;
-		fade_time = 2000;
-	}
+	//default values, written into NVS with the first write
+	nvs_shadow.channel = CH_AB;
+	nvs_shadow.brightness = 20;
+	nvs_shadow.fade_time = 2000;
+	nvs_shadow.color_temp = (CCT_WARM + CCT_COOL) / 2;
+	nvs_missing = NVS_CHANNEL | NVS_BRIGHTNESS | NVS_FADE | NVS_COLOR_TEMP;
 
 	// Open
 	//printf("Reading NVS data... ");
@@ -942,39 +3257,106 @@ void read_nvs_data(bool read_default){
 		if (nvs_get_i8(storage, "curr_channel", &d8) != ESP_OK){
 			printf("current channel not found in NVS\n");
 		}
-		else{
-			current_channel = d8;
+		else if ((d8 >= 0) && (d8 < CH_NUMBER)){
+			nvs_shadow.channel = d8;
+			nvs_missing &= ~NVS_CHANNEL;
 		}
 		
 		if (nvs_get_i32(storage, "brightness", &d32) != ESP_OK){
 			printf("brightness not found in NVS\n");
 		}
 		else{
-			brightness = d32;
+			nvs_shadow.brightness = d32;
+			nvs_missing &= ~NVS_BRIGHTNESS;
 		}
 		
 		if (nvs_get_i32(storage, "fade_time", &d32) != ESP_OK){
 			printf("fade time not found in NVS\n");
 		}
 		else{
-			fade_time = d32;
+			nvs_shadow.fade_time = d32;
+			nvs_missing &= ~NVS_FADE;
+		}
+		
+		if (nvs_get_i32(storage, "color_temp", &d32) != ESP_OK){
+			printf("color temperature not found in NVS\n");
+		}
+		else{
+			nvs_shadow.color_temp = limit_color_temp(d32);
+			nvs_missing &= ~NVS_COLOR_TEMP;
 		}
 		// Close
 		nvs_close(storage);
 	}
+	
+	restore_nvs_data();
+#ifdef CONFIG_LED_LOAD_MANAGER
+	//saved before the budget was changed
+	load_limit_brightness();
+#endif
+}
+
+
+/****************************************************************
+ *
+ * set current values to the last persisted ones, data are taken
+ * from the RAM shadow, flash is not read, led_mux must be taken
+ * (or not created yet)
+ * output:
+ *	mask of properties which are changed (LIGHT_xxx)
+ *
+ * **************************************************************/
+uint8_t restore_nvs_data(void){
+	uint8_t changed = 0;
+	
+	if (current_channel != nvs_shadow.channel){
+		current_channel = nvs_shadow.channel;
+		changed |= LIGHT_CHANNEL;
+	}
+	if (brightness != nvs_shadow.brightness){
+		brightness = nvs_shadow.brightness;
+		changed |= LIGHT_BRGH;
+	}
+	if (fade_time != nvs_shadow.fade_time){
+		fade_time = nvs_shadow.fade_time;
+		changed |= LIGHT_FADE;
+	}
+	if (color_temp != nvs_shadow.color_temp){
+		color_temp = nvs_shadow.color_temp;
+		changed |= LIGHT_CCT;
+	}
+	
+	return changed;
 }
 
+
 /****************************************************************
  *
- * write NVS data into flash memory
- * input:
- *	- data type: channel, brightness or fade time
- *  - data to be written
+ * write current data into flash memory, only values which differ
+ * from the RAM shadow are written, flash is not touched if nothing
+ * is changed, led_mux must be taken
  *
  * **************************************************************/
 void write_nvs_data(void){
 	esp_err_t err;
 	nvs_handle storage = 0;
+	uint8_t dirty = nvs_missing;
+	
+	if (current_channel != nvs_shadow.channel){
+		dirty |= NVS_CHANNEL;
+	}
+	if (brightness != nvs_shadow.brightness){
+		dirty |= NVS_BRIGHTNESS;
+	}
+	if (fade_time != nvs_shadow.fade_time){
+		dirty |= NVS_FADE;
+	}
+	if (color_temp != nvs_shadow.color_temp){
+		dirty |= NVS_COLOR_TEMP;
+	}
+	if (dirty == 0){
+		return;
+	}
 	
 	//open NVS falsh memory
 	err = nvs_open("storage", NVS_READWRITE, &storage);
@@ -982,26 +3364,29 @@ void write_nvs_data(void){
 		printf("Error (%s) opening NVS handle!\n", esp_err_to_name(err));
 	}
 	else {
-		int32_t brgh, ft = 0;
-		int8_t ch = 0;
-		
-		if (nvs_get_i8(storage, "curr_channel", &ch) == ESP_OK){
-			if (ch != current_channel){
-				nvs_set_i8(storage, "curr_channel", current_channel);
-			}
+		if ((dirty & NVS_CHANNEL) != 0){
+			nvs_set_i8(storage, "curr_channel", current_channel);
 		}
-		if (nvs_get_i32(storage, "brightness", &brgh) == ESP_OK){
-			if (brgh != brightness){
-				nvs_set_i32(storage, "brightness", brightness);
-			}
+		if ((dirty & NVS_BRIGHTNESS) != 0){
+			nvs_set_i32(storage, "brightness", brightness);
 		}
-		if (nvs_get_i32(storage, "fade_time", &ft) == ESP_OK){
-			if (ft != fade_time){
-				nvs_set_i32(storage, "fade_time", fade_time);
-			}
+		if ((dirty & NVS_FADE) != 0){
+			nvs_set_i32(storage, "fade_time", fade_time);
+		}
+		if ((dirty & NVS_COLOR_TEMP) != 0){
+			nvs_set_i32(storage, "color_temp", color_temp);
 		}
 		err = nvs_commit(storage);
 		// Close
 		nvs_close(storage);
+		
+		if (err == ESP_OK){
+			nvs_shadow.channel = current_channel;
+			nvs_shadow.brightness = brightness;
+			nvs_shadow.fade_time = fade_time;
+			nvs_shadow.color_temp = color_temp;
+			nvs_missing = 0;
+			nvs_generation++;
+		}
 	}
 }